@@ -1,13 +1,94 @@
 #include "engine.h"
 #include <stdlib.h>
+#include <string>
+#include <future>
 #include "myscene.h"
 
-int main()
+int main(int argc, char** argv)
 {
-	system(R"($HOME/VulkanSDK/1.0.39.1/x86_64/bin/glslangValidator -V -e "main" /home/jankowalski/CodeliteWorkspaces/Vulkan/vulkan001/shader_code/vs.vert -o vs.spv)");
-	system(R"($HOME/VulkanSDK/1.0.39.1/x86_64/bin/glslangValidator -V -e "main" /home/jankowalski/CodeliteWorkspaces/Vulkan/vulkan001/shader_code/fs.frag -o fs.spv)");
+	/*time to first frame is measured from here*/
+	StageTimes& times = VulkanEngine::startupTimes();
+	times.reset();
 	
-	auto ms = std::make_shared<MyScene>();
+	/*engine settings have to be in place before the engine is first accessed*/
+	VulkanEngine::settings().required_features = MyScene::getRequiredFeatures();
+	
+	uint32_t seed = 1;
+	bool seed_on_host = false;
+	
+	for(int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		
+		if(arg == "--headless")
+			VulkanEngine::settings().headless = true;
+		else if(arg == "--frames" && i + 1 < argc)
+			VulkanEngine::settings().headless_frame_count = std::stoul(argv[++i]);
+		else if(arg == "--frames-in-flight" && i + 1 < argc)
+			VulkanEngine::settings().frames_in_flight = std::stoul(argv[++i]);
+		else if(arg == "--present-policy" && i + 1 < argc)
+		{
+			std::string policy = argv[++i];
+			if(policy == "latency")
+				VulkanEngine::settings().present_policy = PresentPolicy::LowestLatency;
+			else if(policy == "throughput")
+				VulkanEngine::settings().present_policy = PresentPolicy::MaxThroughput;
+			else if(policy == "power")
+				VulkanEngine::settings().present_policy = PresentPolicy::PowerSaving;
+		}
+		else if(arg == "--swapchain-images" && i + 1 < argc)
+			VulkanEngine::settings().swapchain_image_count = std::stoul(argv[++i]);
+		else if(arg == "--device" && i + 1 < argc)
+			VulkanEngine::settings().device_override = argv[++i];
+		else if(arg == "--workers" && i + 1 < argc)
+			VulkanEngine::settings().worker_count = std::stoul(argv[++i]);
+		else if(arg == "--particle-format" && i + 1 < argc)
+		{
+			std::string format = argv[++i];
+			if(format == "aos")
+				MyScene::setParticleFormat(ParticleFormat::AoS);
+			else if(format == "soa")
+				MyScene::setParticleFormat(ParticleFormat::SoA);
+			else if(format == "q16")
+				MyScene::setParticleFormat(ParticleFormat::Q16);
+		}
+		else if(arg == "--particles" && i + 1 < argc)
+			MyScene::setParticleCount(std::stoul(argv[++i]));
+		else if(arg == "--seed" && i + 1 < argc)
+			seed = std::stoul(argv[++i]);
+		else if(arg == "--seed-on-host")
+			seed_on_host = true;
+	}
+	
+	/*the same seed gives the same initial particles on the device and on the host*/
+	MyScene::setParticleSeed(seed, seed_on_host);
+	
+	/*shaders compile while the engine brings up the device and swapchain, the scene needs both*/
+	auto compile = [&times](const char* stage, std::string command)
+	{
+		return std::async(std::launch::async, [&times, stage, command] { times.measure(stage, [&command] { system(command.c_str()); }); });
+	};
+	
+	/*the particle shaders are built for the storage format the scene uses, and the bounds it quantizes against*/
+	const std::string particle_format = " -DPARTICLE_FORMAT=" + std::to_string((uint32_t)MyScene::getParticleFormat()) +
+		" -DPARTICLE_BOUND_X=" + std::to_string(x_bound) + " -DPARTICLE_BOUND_Y=" + std::to_string(y_bound) + " -DPARTICLE_BOUND_Z=" + std::to_string(z_bound);
+	
+	auto vs = compile("Shaders: vs.vert", R"($HOME/VulkanSDK/1.0.39.1/x86_64/bin/glslangValidator -V -e "main")" + particle_format + R"( /home/jankowalski/CodeliteWorkspaces/Vulkan/vulkan001/shader_code/vs.vert -o vs.spv)");
+	auto fs = compile("Shaders: fs.frag", R"($HOME/VulkanSDK/1.0.39.1/x86_64/bin/glslangValidator -V -e "main" /home/jankowalski/CodeliteWorkspaces/Vulkan/vulkan001/shader_code/fs.frag -o fs.spv)");
+	auto cs = compile("Shaders: sim.comp", R"($HOME/VulkanSDK/1.0.39.1/x86_64/bin/glslangValidator -V -e "main")" + particle_format + R"( /home/jankowalski/CodeliteWorkspaces/Vulkan/vulkan001/shader_code/sim.comp -o sim.spv)");
+	auto wake_cs = compile("Shaders: wake.comp", R"($HOME/VulkanSDK/1.0.39.1/x86_64/bin/glslangValidator -V -e "main" /home/jankowalski/CodeliteWorkspaces/Vulkan/vulkan001/shader_code/wake.comp -o wake.spv)");
+	auto seed_cs = compile("Shaders: seed.comp", R"($HOME/VulkanSDK/1.0.39.1/x86_64/bin/glslangValidator -V -e "main")" + particle_format + R"( /home/jankowalski/CodeliteWorkspaces/Vulkan/vulkan001/shader_code/seed.comp -o seed.spv)");
+	
+	times.measure("Engine", [] { VulkanEngine::get(); });
+	
+	vs.wait();
+	fs.wait();
+	cs.wait();
+	seed_cs.wait();
+	wake_cs.wait();
+	
+	std::shared_ptr<MyScene> ms;
+	times.measure("Scene", [&ms] { ms = std::make_shared<MyScene>(); });
 	VulkanEngine::get().setScene(ms);
 	VulkanEngine::get().run();
 	
@@ -1,5 +1,10 @@
 #include "Timer.h"
 
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+
 void Timer::reset() noexcept
 {
 	m_paused = false;
@@ -82,4 +87,55 @@ void Timer::stop() noexcept
 float Timer::getTotalTime() noexcept
 {
 	return (float)((std::chrono::duration<double>(std::chrono::system_clock::now() - m_baseTime - m_pausedTime)).count());
+}
+
+StageTimes::StageTimes()
+{
+	reset();
+}
+
+void StageTimes::reset() noexcept
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_baseTime = std::chrono::steady_clock::now();
+	m_stages.clear();
+}
+
+void StageTimes::measure(const std::string& name, const std::function<void()>& fn)
+{
+	auto start = std::chrono::steady_clock::now();
+	fn();
+	record(name, start, std::chrono::steady_clock::now());
+}
+
+void StageTimes::record(const std::string& name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_stages.push_back(Stage{name, std::chrono::duration<double>(start - m_baseTime).count(), std::chrono::duration<double>(end - start).count()});
+}
+
+double StageTimes::getElapsed() const noexcept
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_baseTime).count();
+}
+
+void StageTimes::print(const std::string& title) const
+{
+	std::vector<Stage> stages;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		stages = m_stages;
+	}
+
+	std::stable_sort(stages.begin(), stages.end(), [](const Stage& a, const Stage& b) { return a.start < b.start; });
+
+	/*formatted apart, so std::cout keeps its own flags and precision*/
+	std::ostringstream out;
+	out << title << ": " << std::fixed << std::setprecision(1) << getElapsed() * 1000.0 << " ms\n";
+	for (auto& stage : stages)
+	{
+		out << "    " << std::left << std::setw(32) << stage.name << std::right
+			<< " at " << std::setw(8) << stage.start * 1000.0 << " ms, took " << std::setw(8) << stage.duration * 1000.0 << " ms\n";
+	}
+	std::cout << out.str();
 }
\ No newline at end of file
@@ -2,6 +2,10 @@
 #define TIMER_H
 
 #include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include <mutex>
 
 class Timer
 {
@@ -35,4 +39,36 @@ private:
 	bool m_paused = false;
 };
 
+/*Wall times of named stages which may overlap, such as startup steps running as jobs.
+Stages are recorded relative to the time the StageTimes was created or reset.*/
+class StageTimes
+{
+public:
+	~StageTimes() {};
+	StageTimes();
+
+	void reset() noexcept;
+
+	/*Runs fn and records its wall time as a stage, may be called from any thread*/
+	void measure(const std::string& name, const std::function<void()>& fn);
+	void record(const std::string& name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+	/*Seconds since creation or reset*/
+	double getElapsed() const noexcept;
+	/*Stages sorted by their start, with start offset and duration*/
+	void print(const std::string& title) const;
+
+private:
+	struct Stage
+	{
+		std::string name;
+		double start;
+		double duration;
+	};
+
+	std::chrono::steady_clock::time_point m_baseTime;
+	std::vector<Stage> m_stages;
+	mutable std::mutex m_mutex;
+};
+
 #endif //TIMER_H
\ No newline at end of file
@@ -0,0 +1,542 @@
+#include "allocator.h"
+#include "debug.h"
+
+#include <algorithm>
+
+constexpr VkDeviceSize VulkanAllocator::block_size;
+constexpr VkDeviceSize VulkanAllocator::min_buddy_size;
+constexpr VkDeviceSize VulkanAllocator::dedicated_threshold;
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+const char* MemoryTagToString(MemoryTag tag)
+{
+	switch (tag)
+	{
+	case MemoryTag::Swapchain:
+		return "swapchain";
+	case MemoryTag::RenderTargets:
+		return "render targets";
+	case MemoryTag::Recording:
+		return "recording";
+	case MemoryTag::Particles:
+		return "particles";
+	case MemoryTag::Textures:
+		return "textures";
+	case MemoryTag::Staging:
+		return "staging";
+	default:
+		return "other";
+	}
+}
+
+/*order of the smallest buddy range holding size bytes*/
+static uint32_t buddyOrder(VkDeviceSize size)
+{
+	uint32_t order = 0;
+	while ((VulkanAllocator::min_buddy_size << order) < size)
+		order++;
+
+	return order;
+}
+
+void VulkanAllocator::init(VkDevice device, DeviceDispatch* vk, const VkPhysicalDeviceProperties& props, const VkPhysicalDeviceMemoryProperties& mem_props)
+{
+	m_device = device;
+	m_vk = vk;
+	m_mem_props = mem_props;
+	m_non_coherent_atom_size = std::max<VkDeviceSize>(1, props.limits.nonCoherentAtomSize);
+
+	m_dedicated_count.assign(m_mem_props.memoryTypeCount, 0);
+	m_dedicated_bytes.assign(m_mem_props.memoryTypeCount, 0);
+}
+
+void VulkanAllocator::destroy()
+{
+	for (auto& block : m_blocks)
+	{
+		if (block->allocation_count != 0)
+			cout << "Memory type " << block->memory_type << " block freed with " << block->allocation_count << " live allocations\n";
+
+		destroyBlock(block.get());
+	}
+
+	m_blocks.clear();
+	m_device = VK_NULL_HANDLE;
+}
+
+int32_t VulkanAllocator::findMemoryType(uint32_t memory_type_bits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) const
+{
+	int32_t res = -1;
+	uint32_t best_match = 0;
+
+	for (uint32_t i = 0; i < m_mem_props.memoryTypeCount; i++)
+	{
+		VkMemoryPropertyFlags flags = m_mem_props.memoryTypes[i].propertyFlags;
+
+		if (!(memory_type_bits & (1 << i)) || (flags & required) != required)
+			continue;
+
+		uint32_t match = 0;
+		for (VkMemoryPropertyFlags bits = flags & preferred; bits != 0; bits &= bits - 1)
+			match++;
+
+		if (res == -1 || match > best_match)
+		{
+			res = i;
+			best_match = match;
+		}
+	}
+
+	return res;
+}
+
+MemoryBlock* VulkanAllocator::createBlock(uint32_t memory_type, bool optimal_images, AllocationStrategy strategy)
+{
+	VkMemoryAllocateInfo mem_alloc_info{};
+	mem_alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	mem_alloc_info.pNext = NULL;
+	mem_alloc_info.allocationSize = block_size;
+	mem_alloc_info.memoryTypeIndex = memory_type;
+
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkResult res = vkAllocateMemory(m_device, &mem_alloc_info, VK_NULL_HANDLE, &memory);
+	if (res < 0)
+	{
+		ErrorMessage("Error: Failed to allocate memory block.", res);
+		return NULL;
+	}
+
+	auto block = std::make_unique<MemoryBlock>();
+	block->memory = memory;
+	block->size = block_size;
+	block->memory_type = memory_type;
+	block->strategy = strategy;
+	block->optimal_images = optimal_images;
+
+	if (m_mem_props.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		vkMapMemory(m_device, memory, 0, VK_WHOLE_SIZE, 0, (void**)&block->mapped);
+
+	if (strategy == AllocationStrategy::Buddy)
+	{
+		uint32_t max_order = buddyOrder(block_size);
+		block->free_lists.resize(max_order + 1);
+		block->free_lists[max_order].insert(0);
+	}
+
+	m_blocks.push_back(std::move(block));
+
+	return m_blocks.back().get();
+}
+
+void VulkanAllocator::destroyBlock(MemoryBlock* block)
+{
+	/*freeing mapped memory implicitly unmaps it*/
+	if (block->memory != VK_NULL_HANDLE)
+	{
+		vkFreeMemory(m_device, block->memory, VK_NULL_HANDLE);
+		block->memory = VK_NULL_HANDLE;
+	}
+}
+
+bool VulkanAllocator::allocateFromBlock(MemoryBlock* block, VkDeviceSize size, VkDeviceSize alignment, Allocation& allocation)
+{
+	VkDeviceSize offset;
+	VkDeviceSize reserved;
+	uint32_t order = 0;
+
+	if (block->strategy == AllocationStrategy::Linear)
+	{
+		offset = alignUp(block->head, alignment);
+		if (offset + size > block->size)
+			return false;
+
+		reserved = offset + size - block->head;
+		block->head = offset + size;
+	}
+	else
+	{
+		/*ranges of order n start at multiples of their size, so any power of two alignment up to it holds*/
+		order = buddyOrder(std::max(size, alignment));
+
+		uint32_t o = order;
+		while (o < block->free_lists.size() && block->free_lists[o].empty())
+			o++;
+
+		if (o == block->free_lists.size())
+			return false;
+
+		offset = *block->free_lists[o].begin();
+		block->free_lists[o].erase(block->free_lists[o].begin());
+
+		/*split until the range fits, the upper halves stay free*/
+		while (o > order)
+		{
+			o--;
+			block->free_lists[o].insert(offset + (min_buddy_size << o));
+		}
+
+		reserved = min_buddy_size << order;
+	}
+
+	block->allocation_count++;
+	block->requested_bytes += size;
+	block->reserved_bytes += reserved;
+
+	allocation.memory = block->memory;
+	allocation.offset = offset;
+	allocation.size = size;
+	allocation.mapped = block->mapped ? block->mapped + offset : NULL;
+	allocation.memory_type = block->memory_type;
+	allocation.block = block;
+	allocation.order = order;
+
+	return true;
+}
+
+bool VulkanAllocator::allocateDedicated(uint32_t memory_type, VkDeviceSize size, Allocation& allocation)
+{
+	VkMemoryAllocateInfo mem_alloc_info{};
+	mem_alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	mem_alloc_info.pNext = NULL;
+	mem_alloc_info.allocationSize = size;
+	mem_alloc_info.memoryTypeIndex = memory_type;
+
+	VkResult res = vkAllocateMemory(m_device, &mem_alloc_info, VK_NULL_HANDLE, &allocation.memory);
+	if (res < 0)
+	{
+		ErrorMessage("Error: Failed to allocate dedicated memory.", res);
+		return false;
+	}
+
+	allocation.offset = 0;
+	allocation.size = size;
+	allocation.mapped = NULL;
+	allocation.memory_type = memory_type;
+	allocation.block = NULL;
+	allocation.order = 0;
+
+	if (m_mem_props.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		vkMapMemory(m_device, allocation.memory, 0, VK_WHOLE_SIZE, 0, &allocation.mapped);
+
+	m_dedicated_count[memory_type]++;
+	m_dedicated_bytes[memory_type] += size;
+
+	return true;
+}
+
+bool VulkanAllocator::allocate(const VkMemoryRequirements& req, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+	bool optimal_image, AllocationStrategy strategy, MemoryTag tag, Allocation& allocation)
+{
+	int32_t memory_type = findMemoryType(req.memoryTypeBits, required, preferred);
+	if (memory_type < 0)
+	{
+		ErrorMessage("Error: No memory type meets the allocation requirements.");
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	bool placed = false;
+
+	if (req.size >= dedicated_threshold)
+	{
+		placed = allocateDedicated(memory_type, req.size, allocation);
+	}
+	else
+	{
+		for (auto& block : m_blocks)
+		{
+			if (block->memory_type != (uint32_t)memory_type || block->optimal_images != optimal_image || block->strategy != strategy)
+				continue;
+
+			placed = allocateFromBlock(block.get(), req.size, req.alignment, allocation);
+			if (placed)
+				break;
+		}
+
+		if (!placed)
+		{
+			MemoryBlock* block = createBlock(memory_type, optimal_image, strategy);
+			placed = block != NULL && allocateFromBlock(block, req.size, req.alignment, allocation);
+		}
+	}
+
+	if (placed)
+	{
+		allocation.tag = tag;
+		m_tag_count[(size_t)tag]++;
+		m_tag_bytes[(size_t)tag][m_mem_props.memoryTypes[memory_type].heapIndex] += allocation.size;
+	}
+
+	return placed;
+}
+
+void VulkanAllocator::free(Allocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE)
+		return;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_tag_count[(size_t)allocation.tag]--;
+	m_tag_bytes[(size_t)allocation.tag][m_mem_props.memoryTypes[allocation.memory_type].heapIndex] -= allocation.size;
+
+	MemoryBlock* block = allocation.block;
+
+	if (block == NULL)
+	{
+		vkFreeMemory(m_device, allocation.memory, VK_NULL_HANDLE);
+		m_dedicated_count[allocation.memory_type]--;
+		m_dedicated_bytes[allocation.memory_type] -= allocation.size;
+		allocation = Allocation{};
+		return;
+	}
+
+	block->allocation_count--;
+	block->requested_bytes -= allocation.size;
+
+	if (block->strategy == AllocationStrategy::Linear)
+	{
+		/*a linear block is only reclaimed as a whole*/
+		if (block->allocation_count == 0)
+		{
+			block->head = 0;
+			block->reserved_bytes = 0;
+		}
+	}
+	else
+	{
+		block->reserved_bytes -= min_buddy_size << allocation.order;
+
+		/*merge with the buddy as long as it is free as well*/
+		VkDeviceSize offset = allocation.offset;
+		uint32_t order = allocation.order;
+		while (order + 1 < block->free_lists.size())
+		{
+			VkDeviceSize buddy = offset ^ (min_buddy_size << order);
+			auto it = block->free_lists[order].find(buddy);
+			if (it == block->free_lists[order].end())
+				break;
+
+			block->free_lists[order].erase(it);
+			offset = std::min(offset, buddy);
+			order++;
+		}
+		block->free_lists[order].insert(offset);
+	}
+
+	allocation = Allocation{};
+
+	/*keep one empty block of each kind around, resizes free and reallocate the same resources right away*/
+	if (block->allocation_count == 0)
+	{
+		for (auto it = m_blocks.begin(); it != m_blocks.end(); it++)
+		{
+			MemoryBlock* other = it->get();
+			if (other != block && other->allocation_count == 0 && other->memory_type == block->memory_type &&
+				other->optimal_images == block->optimal_images && other->strategy == block->strategy)
+			{
+				destroyBlock(block);
+				m_blocks.erase(std::find_if(m_blocks.begin(), m_blocks.end(),
+					[block](const std::unique_ptr<MemoryBlock>& b) { return b.get() == block; }));
+				break;
+			}
+		}
+	}
+}
+
+bool VulkanAllocator::allocateImage(VkImage image, VkImageTiling tiling, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+	MemoryTag tag, Allocation& allocation, AllocationStrategy strategy)
+{
+	VkMemoryRequirements mem_req;
+	vkGetImageMemoryRequirements(m_device, image, &mem_req);
+
+	if (!allocate(mem_req, required, preferred, tiling == VK_IMAGE_TILING_OPTIMAL, strategy, tag, allocation))
+		return false;
+
+	VkResult res = vkBindImageMemory(m_device, image, allocation.memory, allocation.offset);
+	if (res < 0)
+	{
+		ErrorMessage("Error: Failed to bind image memory.", res);
+		free(allocation);
+		return false;
+	}
+
+	return true;
+}
+
+bool VulkanAllocator::allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+	MemoryTag tag, Allocation& allocation, AllocationStrategy strategy)
+{
+	VkMemoryRequirements mem_req;
+	vkGetBufferMemoryRequirements(m_device, buffer, &mem_req);
+
+	if (!allocate(mem_req, required, preferred, false, strategy, tag, allocation))
+		return false;
+
+	VkResult res = vkBindBufferMemory(m_device, buffer, allocation.memory, allocation.offset);
+	if (res < 0)
+	{
+		ErrorMessage("Error: Failed to bind buffer memory.", res);
+		free(allocation);
+		return false;
+	}
+
+	return true;
+}
+
+bool VulkanAllocator::isCoherent(uint32_t memory_type) const
+{
+	return m_mem_props.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+}
+
+VkMappedMemoryRange VulkanAllocator::mappedRange(const Allocation& allocation) const
+{
+	/*ranges have to be aligned to nonCoherentAtomSize and stay inside the memory object*/
+	VkDeviceSize memory_size = allocation.block ? allocation.block->size : allocation.size;
+	VkDeviceSize begin = allocation.offset / m_non_coherent_atom_size * m_non_coherent_atom_size;
+	VkDeviceSize end = std::min(alignUp(allocation.offset + allocation.size, m_non_coherent_atom_size), memory_size);
+
+	VkMappedMemoryRange range{};
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.pNext = NULL;
+	range.memory = allocation.memory;
+	range.offset = begin;
+	range.size = end == memory_size ? VK_WHOLE_SIZE : end - begin;
+
+	return range;
+}
+
+void VulkanAllocator::flush(const Allocation& allocation) const
+{
+	if (allocation.mapped == NULL || isCoherent(allocation.memory_type))
+		return;
+
+	VkMappedMemoryRange range = mappedRange(allocation);
+	m_vk->vkFlushMappedMemoryRanges(m_device, 1, &range);
+}
+
+void VulkanAllocator::invalidate(const Allocation& allocation) const
+{
+	if (allocation.mapped == NULL || isCoherent(allocation.memory_type))
+		return;
+
+	VkMappedMemoryRange range = mappedRange(allocation);
+	m_vk->vkInvalidateMappedMemoryRanges(m_device, 1, &range);
+}
+
+MemoryTypeStats VulkanAllocator::getStatistics(uint32_t memory_type) const
+{
+	MemoryTypeStats stats;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto& block : m_blocks)
+	{
+		if (block->memory_type != memory_type)
+			continue;
+
+		stats.block_count++;
+		stats.block_bytes += block->size;
+		stats.allocation_count += block->allocation_count;
+		stats.requested_bytes += block->requested_bytes;
+		stats.reserved_bytes += block->reserved_bytes;
+
+		if (block->strategy == AllocationStrategy::Linear)
+		{
+			VkDeviceSize free_bytes = block->allocation_count == 0 ? block->size : block->size - block->head;
+			stats.free_bytes += free_bytes;
+			stats.largest_free = std::max(stats.largest_free, free_bytes);
+		}
+		else
+		{
+			for (uint32_t o = 0; o < block->free_lists.size(); o++)
+			{
+				if (block->free_lists[o].empty())
+					continue;
+
+				stats.free_bytes += block->free_lists[o].size() * (min_buddy_size << o);
+				stats.largest_free = std::max(stats.largest_free, min_buddy_size << o);
+			}
+		}
+	}
+
+	if (memory_type < m_dedicated_count.size())
+	{
+		stats.dedicated_count = m_dedicated_count[memory_type];
+		stats.dedicated_bytes = m_dedicated_bytes[memory_type];
+	}
+
+	return stats;
+}
+
+VkDeviceSize VulkanAllocator::getHeapUsage(uint32_t heap) const
+{
+	VkDeviceSize usage = 0;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto& block : m_blocks)
+	{
+		if (m_mem_props.memoryTypes[block->memory_type].heapIndex == heap)
+			usage += block->size;
+	}
+
+	for (uint32_t t = 0; t < m_dedicated_bytes.size(); t++)
+	{
+		if (m_mem_props.memoryTypes[t].heapIndex == heap)
+			usage += m_dedicated_bytes[t];
+	}
+
+	return usage;
+}
+
+VkDeviceSize VulkanAllocator::getTagUsage(MemoryTag tag, uint32_t heap) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_tag_bytes[(size_t)tag][heap];
+}
+
+void VulkanAllocator::printStatistics() const
+{
+	constexpr double MiB = 1024.0 * 1024.0;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (size_t tag = 0; tag < (size_t)MemoryTag::Count; tag++)
+		{
+			if (m_tag_count[tag] == 0)
+				continue;
+
+			cout << "Memory " << MemoryTagToString((MemoryTag)tag) << ": " << m_tag_count[tag] << " allocations";
+			for (uint32_t h = 0; h < m_mem_props.memoryHeapCount; h++)
+			{
+				if (m_tag_bytes[tag][h] != 0)
+					cout << ", heap " << h << " " << m_tag_bytes[tag][h] / MiB << " MiB";
+			}
+			cout << '\n';
+		}
+	}
+
+	for (uint32_t t = 0; t < m_mem_props.memoryTypeCount; t++)
+	{
+		MemoryTypeStats stats = getStatistics(t);
+		if (stats.block_count == 0 && stats.dedicated_count == 0)
+			continue;
+
+		/*share of the free space a single request cannot use*/
+		double fragmentation = stats.free_bytes ? 1.0 - (double)stats.largest_free / (double)stats.free_bytes : 0.0;
+
+		cout << "Memory type " << t << " (heap " << m_mem_props.memoryTypes[t].heapIndex << "): "
+			<< stats.block_count << " blocks " << stats.block_bytes / MiB << " MiB, "
+			<< stats.allocation_count << " allocations " << stats.requested_bytes / MiB << " MiB requested "
+			<< stats.reserved_bytes / MiB << " MiB reserved, "
+			<< stats.dedicated_count << " dedicated " << stats.dedicated_bytes / MiB << " MiB, "
+			<< "fragmentation " << fragmentation * 100.0 << "%\n";
+	}
+}
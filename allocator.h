@@ -0,0 +1,156 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <vulkan.h>
+#include <vector>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+#include "dispatch.h"
+
+/*How a request is placed inside a block*/
+enum class AllocationStrategy
+{
+	Buddy,	//power of two ranges, freed and merged individually, for resources recreated at runtime
+	Linear	//bump allocated, a block is reused once every allocation in it was freed, for long lived resources
+};
+
+struct MemoryBlock;
+
+/*Subsystem an allocation is accounted to*/
+enum class MemoryTag : uint8_t
+{
+	Other,
+	Swapchain,
+	RenderTargets,
+	Recording,
+	Particles,
+	Textures,
+	Staging,
+	Count
+};
+
+const char* MemoryTagToString(MemoryTag tag);
+
+/*A range of device memory handed out by VulkanAllocator*/
+struct Allocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	/*host pointer to offset, for host visible memory which stays mapped for the lifetime of its block*/
+	void* mapped = NULL;
+
+	uint32_t memory_type = UINT32_MAX;
+	MemoryTag tag = MemoryTag::Other;
+	/*owning block, NULL for dedicated allocations*/
+	MemoryBlock* block = NULL;
+	uint32_t order = 0;
+};
+
+struct MemoryTypeStats
+{
+	uint32_t block_count = 0;
+	VkDeviceSize block_bytes = 0;
+	uint32_t allocation_count = 0;
+	/*requested sizes, and the sizes actually reserved after rounding and alignment*/
+	VkDeviceSize requested_bytes = 0;
+	VkDeviceSize reserved_bytes = 0;
+	uint32_t dedicated_count = 0;
+	VkDeviceSize dedicated_bytes = 0;
+	/*largest range a single request could still get without a new block*/
+	VkDeviceSize largest_free = 0;
+	VkDeviceSize free_bytes = 0;
+};
+
+struct MemoryBlock
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize size = 0;
+	uint32_t memory_type = 0;
+	uint8_t* mapped = NULL;
+	AllocationStrategy strategy = AllocationStrategy::Buddy;
+	/*optimal tiling images are kept apart from buffers and linear images, so bufferImageGranularity never applies*/
+	bool optimal_images = false;
+
+	uint32_t allocation_count = 0;
+	VkDeviceSize requested_bytes = 0;
+	VkDeviceSize reserved_bytes = 0;
+
+	/*buddy: free range offsets per order, order 0 being min_buddy_size*/
+	std::vector<std::set<VkDeviceSize>> free_lists;
+	/*linear: next free offset*/
+	VkDeviceSize head = 0;
+};
+
+/*Device memory sub-allocator, owned by the engine. Memory is allocated in large blocks per memory type
+and resource kind, requests are placed inside them, large ones get an allocation of their own.
+Allocating, freeing and the statistics may be called from any thread.*/
+class VulkanAllocator
+{
+public:
+	static constexpr VkDeviceSize block_size = 64ull << 20;
+	static constexpr VkDeviceSize min_buddy_size = 256;
+	/*requests at least this large get a dedicated vkAllocateMemory*/
+	static constexpr VkDeviceSize dedicated_threshold = 16ull << 20;
+
+	VulkanAllocator() = default;
+	~VulkanAllocator() = default;
+
+	void init(VkDevice device, DeviceDispatch* vk, const VkPhysicalDeviceProperties& props, const VkPhysicalDeviceMemoryProperties& mem_props);
+	void destroy();
+
+	/*Memory type with all required flags, the one having most of the preferred flags if there is a choice, -1 if none*/
+	int32_t findMemoryType(uint32_t memory_type_bits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred = 0) const;
+
+	bool allocate(const VkMemoryRequirements& req, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+		bool optimal_image, AllocationStrategy strategy, MemoryTag tag, Allocation& allocation);
+	void free(Allocation& allocation);
+
+	/*Allocate and bind in one step*/
+	bool allocateImage(VkImage image, VkImageTiling tiling, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+		MemoryTag tag, Allocation& allocation, AllocationStrategy strategy = AllocationStrategy::Buddy);
+	bool allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+		MemoryTag tag, Allocation& allocation, AllocationStrategy strategy = AllocationStrategy::Buddy);
+
+	/*Host access to non coherent memory, no-ops on coherent memory types*/
+	void flush(const Allocation& allocation) const;
+	void invalidate(const Allocation& allocation) const;
+
+	MemoryTypeStats getStatistics(uint32_t memory_type) const;
+	/*Device memory the allocator holds in a heap, blocks and dedicated allocations*/
+	VkDeviceSize getHeapUsage(uint32_t heap) const;
+	/*Bytes requested by a subsystem in a heap*/
+	VkDeviceSize getTagUsage(MemoryTag tag, uint32_t heap) const;
+	void printStatistics() const;
+
+private:
+	MemoryBlock* createBlock(uint32_t memory_type, bool optimal_images, AllocationStrategy strategy);
+	void destroyBlock(MemoryBlock* block);
+	bool allocateFromBlock(MemoryBlock* block, VkDeviceSize size, VkDeviceSize alignment, Allocation& allocation);
+	bool allocateDedicated(uint32_t memory_type, VkDeviceSize size, Allocation& allocation);
+	bool isCoherent(uint32_t memory_type) const;
+	VkMappedMemoryRange mappedRange(const Allocation& allocation) const;
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	DeviceDispatch* m_vk = NULL;
+	VkPhysicalDeviceMemoryProperties m_mem_props{};
+	VkDeviceSize m_non_coherent_atom_size = 1;
+
+	std::vector<std::unique_ptr<MemoryBlock>> m_blocks;
+
+	/*per memory type*/
+	std::vector<uint32_t> m_dedicated_count;
+	std::vector<VkDeviceSize> m_dedicated_bytes;
+
+	/*per tag, and per tag and heap*/
+	uint32_t m_tag_count[(size_t)MemoryTag::Count] = {};
+	VkDeviceSize m_tag_bytes[(size_t)MemoryTag::Count][VK_MAX_MEMORY_HEAPS] = {};
+
+	/*guards the blocks and every counter above*/
+	mutable std::mutex m_mutex;
+};
+
+#endif //ALLOCATOR_H
@@ -43,4 +43,38 @@ const char* ResultToString(VkResult res)
 	default:
 		return "";
 	}
+}
+
+const char* PresentModeToString(VkPresentModeKHR mode)
+{
+	switch (mode)
+	{
+	case VK_PRESENT_MODE_IMMEDIATE_KHR:
+		return "VK_PRESENT_MODE_IMMEDIATE_KHR";
+	case VK_PRESENT_MODE_MAILBOX_KHR:
+		return "VK_PRESENT_MODE_MAILBOX_KHR";
+	case VK_PRESENT_MODE_FIFO_KHR:
+		return "VK_PRESENT_MODE_FIFO_KHR";
+	case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+		return "VK_PRESENT_MODE_FIFO_RELAXED_KHR";
+	default:
+		return "";
+	}
+}
+
+const char* PhysicalDeviceTypeToString(VkPhysicalDeviceType type)
+{
+	switch (type)
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+		return "discrete GPU";
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+		return "integrated GPU";
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+		return "virtual GPU";
+	case VK_PHYSICAL_DEVICE_TYPE_CPU:
+		return "CPU";
+	default:
+		return "other";
+	}
 }
\ No newline at end of file
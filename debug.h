@@ -6,6 +6,8 @@
 using namespace std;
 
 const char* ResultToString(VkResult res);
+const char* PresentModeToString(VkPresentModeKHR mode);
+const char* PhysicalDeviceTypeToString(VkPhysicalDeviceType type);
 
 template<class Tmsg>
 void ErrorMessage(const Tmsg& msg)
@@ -0,0 +1,40 @@
+#include "deletion_queue.h"
+
+#include <vector>
+
+void DeletionQueue::push(uint64_t frame, std::function<void()> fn)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries.push_back(Entry{frame, std::move(fn)});
+}
+
+void DeletionQueue::collect(uint64_t completed_frame)
+{
+	std::vector<std::function<void()>> retired;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		while (!m_entries.empty() && m_entries.front().frame <= completed_frame)
+		{
+			retired.push_back(std::move(m_entries.front().fn));
+			m_entries.pop_front();
+		}
+	}
+
+	/*run outside the lock, destroying one object may defer another*/
+	for (auto& fn : retired)
+		fn();
+}
+
+void DeletionQueue::flush()
+{
+	/*deferred destruction can queue more, keep going until nothing is left*/
+	while (size() != 0)
+		collect(UINT64_MAX);
+}
+
+size_t DeletionQueue::size() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_entries.size();
+}
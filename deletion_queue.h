@@ -0,0 +1,37 @@
+#ifndef DELETION_QUEUE_H
+#define DELETION_QUEUE_H
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <cstdint>
+
+/*Destruction of objects the device may still be using, deferred until the frame that last
+used them has retired. Frames are pushed in non-decreasing order, the queue stays sorted.*/
+class DeletionQueue
+{
+public:
+	DeletionQueue() = default;
+	~DeletionQueue() = default;
+
+	/*fn destroys objects last used by frame*/
+	void push(uint64_t frame, std::function<void()> fn);
+	/*Runs everything last used by completed_frame or earlier*/
+	void collect(uint64_t completed_frame);
+	/*Runs everything, the caller made sure the device is done with it*/
+	void flush();
+
+	size_t size() const;
+
+private:
+	struct Entry
+	{
+		uint64_t frame;
+		std::function<void()> fn;
+	};
+
+	std::deque<Entry> m_entries;
+	mutable std::mutex m_mutex;
+};
+
+#endif //DELETION_QUEUE_H
@@ -0,0 +1,72 @@
+#include "dispatch.h"
+#include "debug.h"
+
+bool DeviceDispatch::load(VkDevice device, bool swapchain)
+{
+	bool res = true;
+
+#define DEVICE_FUNCTION_LOAD(name) \
+	name.set((PFN_##name)vkGetDeviceProcAddr(device, #name)); \
+	if (!name.loaded()) \
+	{ \
+		ErrorMessage("Error: Failed to load device function " #name "."); \
+		res = false; \
+	}
+
+	DEVICE_DISPATCH_FUNCTIONS(DEVICE_FUNCTION_LOAD)
+
+	if (swapchain)
+	{
+		DEVICE_DISPATCH_SWAPCHAIN_FUNCTIONS(DEVICE_FUNCTION_LOAD)
+	}
+#undef DEVICE_FUNCTION_LOAD
+
+	return res;
+}
+
+void DeviceDispatch::endFrame()
+{
+#define DEVICE_FUNCTION_TAKE(name) m_frame_calls[(size_t)DeviceFunction::name] = name.takeCalls();
+	DEVICE_DISPATCH_FUNCTIONS(DEVICE_FUNCTION_TAKE)
+	DEVICE_DISPATCH_SWAPCHAIN_FUNCTIONS(DEVICE_FUNCTION_TAKE)
+#undef DEVICE_FUNCTION_TAKE
+}
+
+uint32_t DeviceDispatch::getFrameCalls(DeviceFunction function) const noexcept
+{
+	return m_frame_calls[(size_t)function];
+}
+
+uint32_t DeviceDispatch::getFrameCallsTotal() const noexcept
+{
+	uint32_t total = 0;
+	for (size_t i = 0; i < (size_t)DeviceFunction::Count; i++)
+	{
+		total += m_frame_calls[i];
+	}
+	return total;
+}
+
+void DeviceDispatch::printCallStatistics() const
+{
+	cout << "Vulkan calls last frame: " << getFrameCallsTotal() << '\n';
+
+	for (size_t i = 0; i < (size_t)DeviceFunction::Count; i++)
+	{
+		if (m_frame_calls[i] != 0)
+			cout << "    " << getFunctionName((DeviceFunction)i) << ": " << m_frame_calls[i] << '\n';
+	}
+}
+
+const char* DeviceDispatch::getFunctionName(DeviceFunction function)
+{
+	switch (function)
+	{
+#define DEVICE_FUNCTION_NAME(name) case DeviceFunction::name: return #name;
+	DEVICE_DISPATCH_FUNCTIONS(DEVICE_FUNCTION_NAME)
+	DEVICE_DISPATCH_SWAPCHAIN_FUNCTIONS(DEVICE_FUNCTION_NAME)
+#undef DEVICE_FUNCTION_NAME
+	default:
+		return "unknown";
+	}
+}
@@ -0,0 +1,110 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <vulkan.h>
+#include <atomic>
+#include <cstdint>
+
+/*Device level functions called every frame. They are loaded with vkGetDeviceProcAddr and
+called directly instead of going through the loader's dispatch trampolines.*/
+#define DEVICE_DISPATCH_FUNCTIONS(X) \
+	X(vkQueueSubmit) \
+	X(vkQueueWaitIdle) \
+	X(vkWaitForFences) \
+	X(vkResetFences) \
+	X(vkGetFenceStatus) \
+	X(vkBeginCommandBuffer) \
+	X(vkEndCommandBuffer) \
+	X(vkResetCommandPool) \
+	X(vkCmdBindPipeline) \
+	X(vkCmdSetViewport) \
+	X(vkCmdSetScissor) \
+	X(vkCmdPushConstants) \
+	X(vkCmdBindDescriptorSets) \
+	X(vkCmdBeginRenderPass) \
+	X(vkCmdEndRenderPass) \
+	X(vkCmdDraw) \
+	X(vkCmdDrawIndirect) \
+	X(vkCmdDispatch) \
+	X(vkCmdDispatchIndirect) \
+	X(vkCmdWriteTimestamp) \
+	X(vkCmdResetQueryPool) \
+	X(vkGetQueryPoolResults) \
+	X(vkCmdPipelineBarrier) \
+	X(vkCmdBlitImage) \
+	X(vkCmdCopyImage) \
+	X(vkCmdCopyBufferToImage) \
+	X(vkCmdCopyBuffer) \
+	X(vkCmdUpdateBuffer) \
+	X(vkCmdFillBuffer) \
+	X(vkUpdateDescriptorSets) \
+	X(vkFlushMappedMemoryRanges) \
+	X(vkInvalidateMappedMemoryRanges)
+
+/*VK_KHR_swapchain, not loaded in headless mode*/
+#define DEVICE_DISPATCH_SWAPCHAIN_FUNCTIONS(X) \
+	X(vkAcquireNextImageKHR) \
+	X(vkQueuePresentKHR)
+
+/*Device function pointer that counts its calls. operator() has the exact parameter list of
+the Vulkan function, so arguments convert the same way they do for a direct call.*/
+template<typename PFN>
+class CountedFunction;
+
+template<typename R, typename... P>
+class CountedFunction<R (VKAPI_PTR*)(P...)>
+{
+public:
+	R operator()(P... params)
+	{
+		m_calls.fetch_add(1, std::memory_order_relaxed);
+		return m_pfn(params...);
+	}
+
+	void set(R (VKAPI_PTR* pfn)(P...)) noexcept { m_pfn = pfn; }
+	bool loaded() const noexcept { return m_pfn != NULL; }
+	uint32_t takeCalls() noexcept { return m_calls.exchange(0, std::memory_order_relaxed); }
+
+private:
+	R (VKAPI_PTR* m_pfn)(P...) = NULL;
+	std::atomic<uint32_t> m_calls{0};
+};
+
+enum class DeviceFunction : uint32_t
+{
+#define DEVICE_FUNCTION_ENUM(name) name,
+	DEVICE_DISPATCH_FUNCTIONS(DEVICE_FUNCTION_ENUM)
+	DEVICE_DISPATCH_SWAPCHAIN_FUNCTIONS(DEVICE_FUNCTION_ENUM)
+#undef DEVICE_FUNCTION_ENUM
+	Count
+};
+
+/*Dispatch table of one device. Every call goes through here, which makes it the place
+where API calls are counted, the counts of the last completed frame are kept by endFrame()*/
+class DeviceDispatch
+{
+public:
+	DeviceDispatch() = default;
+	~DeviceDispatch() = default;
+
+	bool load(VkDevice device, bool swapchain);
+
+	/*called like the functions they replace, vk.vkCmdDraw(cmd_buf, ...)*/
+#define DEVICE_FUNCTION_MEMBER(name) CountedFunction<PFN_##name> name;
+	DEVICE_DISPATCH_FUNCTIONS(DEVICE_FUNCTION_MEMBER)
+	DEVICE_DISPATCH_SWAPCHAIN_FUNCTIONS(DEVICE_FUNCTION_MEMBER)
+#undef DEVICE_FUNCTION_MEMBER
+
+	/*Closes the current frame's call counts and starts counting the next one*/
+	void endFrame();
+	uint32_t getFrameCalls(DeviceFunction function) const noexcept;
+	uint32_t getFrameCallsTotal() const noexcept;
+	void printCallStatistics() const;
+
+	static const char* getFunctionName(DeviceFunction function);
+
+private:
+	uint32_t m_frame_calls[(size_t)DeviceFunction::Count] = {};
+};
+
+#endif //DISPATCH_H
@@ -3,6 +3,15 @@
 
 #include <iostream>
 #include <string>
+#include <chrono>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <cctype>
+#include <thread>
 
 #include "vulkan_math.h"
 
@@ -15,6 +24,20 @@ VulkanEngine& VulkanEngine::get()
 	return m_ptr;
 }
 
+EngineSettings& VulkanEngine::settings()
+{
+	static EngineSettings m_settings;
+	
+	return m_settings;
+}
+
+StageTimes& VulkanEngine::startupTimes()
+{
+	static StageTimes m_startup_times;
+	
+	return m_startup_times;
+}
+
 VulkanEngine::VulkanEngine()
 {
 	/*if initialization fails, destroy whatever was created*/
@@ -32,6 +55,16 @@ VulkanEngine::~VulkanEngine()
 void VulkanEngine::stop()
 {
 	m_running = false;
+	wake();
+}
+
+void VulkanEngine::wake()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_wake_mutex);
+		m_wake_pending = true;
+	}
+	m_wake_cv.notify_one();
 }
 
 void VulkanEngine::EnableLayersAndExtensions()
@@ -40,10 +73,31 @@ void VulkanEngine::EnableLayersAndExtensions()
 	
 //extensions-------------------------------------
 	
-	m_instance_extensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
-	m_instance_extensions.push_back(VK_PLATFORM_SURFACE_EXTENSION_NAME);
+	/*no window system integration is needed in headless mode*/
+	if (!settings().headless)
+	{
+		m_instance_extensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+		m_instance_extensions.push_back(VK_PLATFORM_SURFACE_EXTENSION_NAME);
 
-	m_device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+		m_device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+	}
+
+	/*memory budget queries go through vkGetPhysicalDeviceMemoryProperties2KHR*/
+#ifdef VK_EXT_memory_budget
+	std::vector<VkExtensionProperties> e_props;
+	vkEnumerateInstanceExtensionProperties(NULL, &count, VK_NULL_HANDLE);
+	e_props.resize(count);
+	vkEnumerateInstanceExtensionProperties(NULL, &count, e_props.data());
+
+	for (auto& ext : e_props)
+	{
+		if (strcmp(ext.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+		{
+			m_instance_extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+			m_properties2_enabled = true;
+		}
+	}
+#endif//VK_EXT_memory_budget
 
 //layers-----------------------------------------
 
@@ -64,22 +118,33 @@ void VulkanEngine::EnableLayersAndExtensions()
 bool VulkanEngine::Initialize()
 {
 	bool res;
+	StageTimes& times = startupTimes();
 
-	m_window = std::make_unique<VulkanWindow>();
+	if (!settings().headless)
+	{
+		times.measure("Engine: window", [this] { m_window = std::make_unique<VulkanWindow>(); });
+	}
+
+	m_jobs.init(settings().worker_count);
+	cout << "Job system: " << m_jobs.getWorkerCount() << " workers" << '\n';
 
 	EnableLayersAndExtensions();
 
-	res = InitInstance();
+	times.measure("Engine: instance", [&] { res = InitInstance(); });
 	if (res == false)
 		return false;
 
 	InitDebug();
 
-	res = InitDevice();
+	times.measure("Engine: device", [&] { res = InitDevice(); });
+	if (res == false)
+		return false;
+
+	times.measure("Engine: pipeline cache", [&] { res = InitPipelineCache(); });
 	if (res == false)
 		return false;
 
-	res = InitSurfaceDependentObjects();
+	times.measure("Engine: surface and swapchain", [&] { res = InitSurfaceDependentObjects(); });
 	if (res == false)
 		return false;
 
@@ -96,11 +161,33 @@ void VulkanEngine::Destroy()
 		vkDeviceWaitIdle(m_device);
 	}
 
+	if (m_device != VK_NULL_HANDLE)
+	{
+		printMemoryReport();
+	}
+
 	/*delete scene first*/
 	m_scene.reset();
 
+	/*the device is idle, whatever the scene deferred can go now*/
+	m_deletion_queue.flush();
+
+	m_transfer.destroy();
+
+	/*the scene waited for its own jobs, whatever is left finishes before the workers exit*/
+	m_jobs.printStatistics();
+	m_jobs.destroy();
+
 	DeinitSurfaceDependentObjects();
 
+	DeinitPipelineCache();
+
+	/*by now every resource returned its memory, the allocator warns about what is left*/
+	if (m_device != VK_NULL_HANDLE)
+	{
+		m_allocator.destroy();
+	}
+
 	if (m_device != VK_NULL_HANDLE)
 	{
 		vkDestroyDevice(m_device, VK_NULL_HANDLE);
@@ -151,14 +238,195 @@ bool VulkanEngine::InitInstance()
 	return true;
 }
 
-bool VulkanEngine::InitDevice()
+int64_t VulkanEngine::ScorePhysicalDevice(VkPhysicalDevice device, std::string& reason) const
 {
-	uint32_t device_count;
+	VkPhysicalDeviceProperties props;
+	VkPhysicalDeviceFeatures features;
+	VkPhysicalDeviceMemoryProperties mem_props;
+	vkGetPhysicalDeviceProperties(device, &props);
+	vkGetPhysicalDeviceFeatures(device, &features);
+	vkGetPhysicalDeviceMemoryProperties(device, &mem_props);
+
+	std::ostringstream why;
+
+	/*the feature structure is a plain sequence of VkBool32*/
+	const VkBool32* required = reinterpret_cast<const VkBool32*>(&settings().required_features);
+	const VkBool32* supported = reinterpret_cast<const VkBool32*>(&features);
+	for (size_t i = 0; i < sizeof(VkPhysicalDeviceFeatures) / sizeof(VkBool32); i++)
+	{
+		if (required[i] && !supported[i])
+		{
+			reason = "missing a required feature";
+			return -1;
+		}
+	}
+
+	uint32_t extension_count;
+	vkEnumerateDeviceExtensionProperties(device, NULL, &extension_count, VK_NULL_HANDLE);
+	std::vector<VkExtensionProperties> extensions(extension_count);
+	vkEnumerateDeviceExtensionProperties(device, NULL, &extension_count, extensions.data());
+
+	for (auto name : m_device_extensions)
+	{
+		auto found = std::find_if(extensions.begin(), extensions.end(),
+			[name](const VkExtensionProperties& ext) { return strcmp(ext.extensionName, name) == 0; });
+		if (found == extensions.end())
+		{
+			reason = std::string("missing extension ") + name;
+			return -1;
+		}
+	}
+
+	uint32_t family_count;
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &family_count, VK_NULL_HANDLE);
+	std::vector<VkQueueFamilyProperties> queue_families(family_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &family_count, queue_families.data());
+
+	bool has_graphics = false;
+	bool has_transfer = false;
+	for (auto& family : queue_families)
+	{
+		if (family.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			has_graphics = true;
+		else if ((family.queueFlags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT)) == VK_QUEUE_TRANSFER_BIT)
+			has_transfer = true;
+	}
+
+	if (!has_graphics)
+	{
+		reason = "no graphics queue family";
+		return -1;
+	}
+
+	int64_t score = 0;
+	switch (props.deviceType)
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+		score += 100000;
+		break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+		score += 50000;
+		break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+		score += 20000;
+		break;
+	default:
+		break;
+	}
+	why << PhysicalDeviceTypeToString(props.deviceType);
+
+	/*largest device local heap in MiB, enough to order devices of the same type*/
+	VkDeviceSize device_local = 0;
+	for (uint32_t i = 0; i < mem_props.memoryHeapCount; i++)
+	{
+		if (mem_props.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+			device_local = std::max(device_local, mem_props.memoryHeaps[i].size);
+	}
+	score += device_local >> 20;
+	why << ", " << (device_local >> 20) << " MiB device local";
+
+	if (has_transfer)
+	{
+		score += 1000;
+		why << ", dedicated transfer queue";
+	}
+
+	reason = why.str();
+	return score;
+}
+
+bool VulkanEngine::MatchesDeviceOverride(VkPhysicalDevice device, const std::string& device_override) const
+{
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(device, &props);
+
+	if (strstr(props.deviceName, device_override.c_str()) != NULL)
+		return true;
+
+	std::ostringstream uuid;
+	for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+		uuid << std::hex << std::setw(2) << std::setfill('0') << (uint32_t)props.pipelineCacheUUID[i];
+
+	std::string wanted;
+	for (char c : device_override)
+	{
+		if (c != '-')
+			wanted += tolower(c);
+	}
+
+	return wanted == uuid.str();
+}
+
+bool VulkanEngine::SelectPhysicalDevice()
+{
+	uint32_t device_count = 0;
 	vkEnumeratePhysicalDevices(m_instance, &device_count, VK_NULL_HANDLE);
 	std::vector<VkPhysicalDevice> devices(device_count);
 	vkEnumeratePhysicalDevices(m_instance, &device_count, devices.data());
 
-	m_physical_device = devices[0];
+	if (device_count == 0)
+	{
+		ErrorMessage("Error: No physical device with Vulkan support found.");
+		return false;
+	}
+
+	std::string device_override = settings().device_override;
+	const char* env_override = getenv("VULKAN001_DEVICE");
+	if (env_override != NULL && env_override[0] != '\0')
+		device_override = env_override;
+
+	int64_t best_score = -1;
+	std::string best_reason;
+	bool overridden = false;
+
+	for (auto device : devices)
+	{
+		VkPhysicalDeviceProperties props;
+		vkGetPhysicalDeviceProperties(device, &props);
+
+		std::string reason;
+		int64_t score = ScorePhysicalDevice(device, reason);
+		cout << "Physical device candidate: " << props.deviceName << ", score " << score << " (" << reason << ")\n";
+
+		if (score < 0)
+			continue;
+
+		if (!device_override.empty() && MatchesDeviceOverride(device, device_override))
+		{
+			m_physical_device = device;
+			best_reason = "matches override \"" + device_override + "\"";
+			overridden = true;
+			break;
+		}
+
+		if (score > best_score)
+		{
+			m_physical_device = device;
+			best_score = score;
+			best_reason = reason;
+		}
+	}
+
+	if (m_physical_device == VK_NULL_HANDLE)
+	{
+		ErrorMessage("Error: No physical device meets the requirements.");
+		return false;
+	}
+
+	if (!device_override.empty() && !overridden)
+		cout << "Physical device override \"" << device_override << "\" matched no suitable device\n";
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(m_physical_device, &props);
+	cout << "Using physical device: " << props.deviceName << " (" << best_reason << ")\n";
+
+	return true;
+}
+
+bool VulkanEngine::InitDevice()
+{
+	if (!SelectPhysicalDevice())
+		return false;
 
 	vkGetPhysicalDeviceProperties(m_physical_device, &m_physical_device_properties);
 	vkGetPhysicalDeviceFeatures(m_physical_device, &m_physical_device_features);
@@ -176,20 +444,58 @@ bool VulkanEngine::InitDevice()
 			if (m_queue_family_index_general == -1)
 				m_queue_family_index_general = i;
 		}
-		else if (queue_families[i].queueFlags == VK_QUEUE_TRANSFER_BIT)
+		/*dedicated transfer families may also report sparse binding*/
+		else if ((queue_families[i].queueFlags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT)) == VK_QUEUE_TRANSFER_BIT)
 		{
 			if (m_queue_family_index_transfer == -1)
 				m_queue_family_index_transfer = i;
 		}
 	}
 
+	uint32_t extension_count;
+	vkEnumerateDeviceExtensionProperties(m_physical_device, NULL, &extension_count, VK_NULL_HANDLE);
+	std::vector<VkExtensionProperties> extensions(extension_count);
+	vkEnumerateDeviceExtensionProperties(m_physical_device, NULL, &extension_count, extensions.data());
+
+	for (auto& ext : extensions)
+	{
+		/*pipeline creation feedback tells pipeline cache hits from misses, enable it where it exists*/
+#ifdef VK_EXT_pipeline_creation_feedback
+		if (strcmp(ext.extensionName, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME) == 0)
+		{
+			m_device_extensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+			m_creation_feedback_enabled = true;
+		}
+#endif//VK_EXT_pipeline_creation_feedback
+
+		/*the memory budget shows how much of each heap the driver lets us use alongside other processes*/
+#ifdef VK_EXT_memory_budget
+		if (m_properties2_enabled && strcmp(ext.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+		{
+			m_device_extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+			m_memory_budget_enabled = true;
+		}
+#endif//VK_EXT_memory_budget
+	}
+
 	float queue_priorities[] = { 1.0f };
 
-	VkDeviceQueueCreateInfo queue_create_info{};
-	queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-	queue_create_info.queueCount = 1;
-	queue_create_info.queueFamilyIndex = m_queue_family_index_general;
-	queue_create_info.pQueuePriorities = queue_priorities;
+	/*without a dedicated transfer family transfers go to the general queue*/
+	if (m_queue_family_index_transfer == -1)
+		m_queue_family_index_transfer = m_queue_family_index_general;
+
+	std::vector<VkDeviceQueueCreateInfo> queue_create_infos(1);
+	queue_create_infos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queue_create_infos[0].pNext = NULL;
+	queue_create_infos[0].queueCount = 1;
+	queue_create_infos[0].queueFamilyIndex = m_queue_family_index_general;
+	queue_create_infos[0].pQueuePriorities = queue_priorities;
+
+	if (m_queue_family_index_transfer != m_queue_family_index_general)
+	{
+		queue_create_infos.push_back(queue_create_infos[0]);
+		queue_create_infos[1].queueFamilyIndex = m_queue_family_index_transfer;
+	}
 
 	VkDeviceCreateInfo device_create_info{};
 	device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -197,9 +503,11 @@ bool VulkanEngine::InitDevice()
 	device_create_info.ppEnabledExtensionNames = m_device_extensions.data();
 	device_create_info.enabledLayerCount = 0;
 	device_create_info.ppEnabledLayerNames = NULL;
-	device_create_info.queueCreateInfoCount = 1;
-	device_create_info.pQueueCreateInfos = &queue_create_info;
-	device_create_info.pEnabledFeatures = &m_physical_device_features;
+	device_create_info.queueCreateInfoCount = queue_create_infos.size();
+	device_create_info.pQueueCreateInfos = queue_create_infos.data();
+	/*enabling features the scene does not use can cost performance in the driver*/
+	m_enabled_features = settings().required_features;
+	device_create_info.pEnabledFeatures = &m_enabled_features;
 
 	VkResult res = vkCreateDevice(m_physical_device, &device_create_info, VK_NULL_HANDLE, &m_device);
 	if (res < 0)
@@ -208,26 +516,280 @@ bool VulkanEngine::InitDevice()
 		return false;
 	}
 
+	/*per frame calls skip the loader trampolines*/
+	if (!m_vk.load(m_device, !settings().headless))
+		return false;
+
+	vkGetDeviceQueue(m_device, m_queue_family_index_general, 0, &m_queue_general);
+	vkGetDeviceQueue(m_device, m_queue_family_index_transfer, 0, &m_queue_transfer);
+
+	m_allocator.init(m_device, &m_vk, m_physical_device_properties, m_physical_device_memory_properties);
+
+	if (!m_transfer.init(m_device, &m_vk, &m_allocator, m_queue_transfer, m_queue_family_index_transfer, m_queue_general, m_queue_family_index_general))
+		return false;
+
+	cout << "Transfer queue family: " << m_queue_family_index_transfer << (m_transfer.isDedicated() ? " (dedicated)" : " (shared with graphics)") << '\n';
+
 	return true;
 }
 
+//pipeline cache-------------------------------------
+
+/*Prepended to the driver's cache data, the driver only checks its own header
+so the driver version has to be validated by us*/
+struct PipelineCacheFileHeader
+{
+	uint32_t magic;
+	uint32_t vendor_id;
+	uint32_t device_id;
+	uint32_t driver_version;
+	uint8_t cache_uuid[VK_UUID_SIZE];
+	uint64_t data_size;
+};
+
+constexpr const uint32_t pipeline_cache_magic = 0x31304B56; //"VK01"
+
+bool VulkanEngine::InitPipelineCache()
+{
+	const VkPhysicalDeviceProperties& props = m_physical_device_properties;
+	const std::string& path = settings().pipeline_cache_path;
+	std::vector<char> data;
+
+	if (!path.empty())
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		PipelineCacheFileHeader header{};
+
+		/*the size in the header is only trusted as far as the file actually goes*/
+		const std::streamoff file_size = file ? (std::streamoff)file.tellg() : 0;
+		file.seekg(0);
+
+		if (file && file.read((char*)&header, sizeof(header)))
+		{
+			if (header.magic != pipeline_cache_magic)
+				cout << "Pipeline cache: " << path << " is not a pipeline cache file, starting cold" << endl;
+			else if (header.vendor_id != props.vendorID || header.device_id != props.deviceID)
+				cout << "Pipeline cache: " << path << " was written for a different device, starting cold" << endl;
+			else if (header.driver_version != props.driverVersion)
+				cout << "Pipeline cache: " << path << " was written by a different driver version, starting cold" << endl;
+			else if (memcmp(header.cache_uuid, props.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+				cout << "Pipeline cache: " << path << " has a mismatching cache UUID, starting cold" << endl;
+			else if (header.data_size > (uint64_t)(file_size - (std::streamoff)sizeof(header)))
+				cout << "Pipeline cache: " << path << " is truncated, starting cold" << endl;
+			else
+			{
+				data.resize(header.data_size);
+				if (!file.read(data.data(), data.size()))
+				{
+					cout << "Pipeline cache: " << path << " is truncated, starting cold" << endl;
+					data.clear();
+				}
+			}
+		}
+	}
+
+	VkPipelineCacheCreateInfo cache_create_info{};
+	cache_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cache_create_info.pNext = NULL;
+	cache_create_info.flags = 0;
+	cache_create_info.initialDataSize = data.size();
+	cache_create_info.pInitialData = data.empty() ? NULL : data.data();
+
+	VkResult res = vkCreatePipelineCache(m_device, &cache_create_info, VK_NULL_HANDLE, &m_pipeline_cache);
+	if (res < 0)
+	{
+		ErrorMessage("Error: Failed to create pipeline cache.", res);
+		return false;
+	}
+
+	m_pipeline_cache_stats.loaded_size = data.size();
+
+	return true;
+}
+
+void VulkanEngine::DeinitPipelineCache()
+{
+	if (m_pipeline_cache == VK_NULL_HANDLE)
+		return;
+
+	const PipelineCacheStats& stats = m_pipeline_cache_stats;
+	cout << "Pipeline cache: " << (stats.loaded_size ? "warm" : "cold") << " start (" << stats.loaded_size << " bytes loaded), ";
+	if (m_creation_feedback_enabled)
+		cout << stats.hits << " hits, " << stats.misses << " misses, ";
+	else
+		cout << "hits not reported without creation feedback, ";
+	cout << stats.creation_us / 1000.0 << " ms spent creating pipelines" << endl;
+
+	const std::string& path = settings().pipeline_cache_path;
+	if (!path.empty())
+	{
+		size_t size = 0;
+		vkGetPipelineCacheData(m_device, m_pipeline_cache, &size, NULL);
+		std::vector<char> data(size);
+		VkResult res = vkGetPipelineCacheData(m_device, m_pipeline_cache, &size, data.data());
+
+		if (res == VK_SUCCESS)
+		{
+			PipelineCacheFileHeader header{};
+			header.magic = pipeline_cache_magic;
+			header.vendor_id = m_physical_device_properties.vendorID;
+			header.device_id = m_physical_device_properties.deviceID;
+			header.driver_version = m_physical_device_properties.driverVersion;
+			memcpy(header.cache_uuid, m_physical_device_properties.pipelineCacheUUID, VK_UUID_SIZE);
+			header.data_size = size;
+
+			std::ofstream file(path, std::ios::binary | std::ios::trunc);
+			file.write((const char*)&header, sizeof(header));
+			file.write(data.data(), size);
+
+			if (!file)
+				ErrorMessage("Error: Failed to write pipeline cache file.");
+		}
+		else
+		{
+			ErrorMessage("Error: Failed to get pipeline cache data.", res);
+		}
+	}
+
+	vkDestroyPipelineCache(m_device, m_pipeline_cache, VK_NULL_HANDLE);
+	m_pipeline_cache = VK_NULL_HANDLE;
+}
+
+VkResult VulkanEngine::createGraphicsPipelines(uint32_t count, const VkGraphicsPipelineCreateInfo* create_infos, VkPipeline* pipelines)
+{
+	return CreatePipelines(count, create_infos, pipelines, vkCreateGraphicsPipelines);
+}
+
+VkResult VulkanEngine::createComputePipelines(uint32_t count, const VkComputePipelineCreateInfo* create_infos, VkPipeline* pipelines)
+{
+	return CreatePipelines(count, create_infos, pipelines, vkCreateComputePipelines);
+}
+
+static uint32_t PipelineStageCount(const VkGraphicsPipelineCreateInfo& info)
+{
+	return info.stageCount;
+}
+
+static uint32_t PipelineStageCount(const VkComputePipelineCreateInfo&)
+{
+	return 1;
+}
+
+template<typename CreateInfo, typename CreateFn>
+VkResult VulkanEngine::CreatePipelines(uint32_t count, const CreateInfo* create_infos, VkPipeline* pipelines, CreateFn create)
+{
+	std::vector<CreateInfo> infos(create_infos, create_infos + count);
+
+#ifdef VK_EXT_pipeline_creation_feedback
+	std::vector<VkPipelineCreationFeedbackEXT> feedback(count);
+	std::vector<std::vector<VkPipelineCreationFeedbackEXT>> stage_feedback(count);
+	std::vector<VkPipelineCreationFeedbackCreateInfoEXT> feedback_infos(count);
+
+	if (m_creation_feedback_enabled)
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			stage_feedback[i].resize(PipelineStageCount(infos[i]));
+
+			feedback_infos[i].sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+			feedback_infos[i].pNext = infos[i].pNext;
+			feedback_infos[i].pPipelineCreationFeedback = &feedback[i];
+			feedback_infos[i].pipelineStageCreationFeedbackCount = PipelineStageCount(infos[i]);
+			feedback_infos[i].pPipelineStageCreationFeedbacks = stage_feedback[i].data();
+
+			infos[i].pNext = &feedback_infos[i];
+		}
+	}
+#endif//VK_EXT_pipeline_creation_feedback
+
+	auto start = std::chrono::steady_clock::now();
+
+	VkResult res = create(m_device, m_pipeline_cache, count, infos.data(), VK_NULL_HANDLE, pipelines);
+
+	m_pipeline_cache_stats.creation_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+	if (res < 0)
+	{
+		ErrorMessage("Error: Failed to create pipelines.", res);
+		return res;
+	}
+
+#ifdef VK_EXT_pipeline_creation_feedback
+	if (m_creation_feedback_enabled)
+	{
+		for (auto& fb : feedback)
+		{
+			if (!(fb.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT))
+				continue;
+
+			if (fb.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT)
+				m_pipeline_cache_stats.hits++;
+			else
+				m_pipeline_cache_stats.misses++;
+		}
+	}
+#endif//VK_EXT_pipeline_creation_feedback
+
+	/*without creation feedback hits are not counted, comparing cache sizes around the call
+	does not tell them apart while other threads create pipelines in the same cache*/
+	return res;
+}
+
+VkPipelineCache VulkanEngine::getPipelineCache() const noexcept
+{
+	return m_pipeline_cache;
+}
+
+const PipelineCacheStats& VulkanEngine::getPipelineCacheStats() const noexcept
+{
+	return m_pipeline_cache_stats;
+}
+
 //surface dependent----------------------------------
 
 void VulkanEngine::onResize()
 {
-	vkDeviceWaitIdle(m_device);
-	
-	DeinitSurfaceDependentObjects();
+	/*the surface stays, only the swapchain is recreated, and that happens on the next
+	acquire from the render loop instead of draining the device here*/
+	if (!settings().headless)
+		m_swapchain_dirty = true;
+}
 
-	InitSurfaceDependentObjects();
+void VulkanEngine::setPresentPolicy(PresentPolicy policy, uint32_t image_count)
+{
+	settings().present_policy = policy;
+	settings().swapchain_image_count = image_count;
 	
-	m_scene->onResize();
+	/*the virtual swapchain is never presented, the policy has nothing to change there*/
+	if (!settings().headless)
+		m_swapchain_dirty = true;
+}
+
+bool VulkanEngine::RecreateSwapchain()
+{
+	if (!InitSwapchain())
+		return false;
+
+	m_swapchain_dirty = false;
+
+	if (m_scene)
+		m_scene->onResize();
+
+	return true;
+}
+
+void VulkanEngine::destroyLater(std::function<void()> fn)
+{
+	m_deletion_queue.push(m_frame_serial, std::move(fn));
 }
 
 bool VulkanEngine::InitSurfaceDependentObjects()
 {
 	bool res;
 
+	if (settings().headless)
+		return InitVirtualSwapchain();
+
 	res = InitSurface();
 	if (res == false)
 		return false;
@@ -241,6 +803,15 @@ bool VulkanEngine::InitSurfaceDependentObjects()
 
 void VulkanEngine::DeinitSurfaceDependentObjects()
 {
+	if (settings().headless)
+	{
+		DeinitVirtualSwapchain();
+		return;
+	}
+	
+	/*retired swapchains have to go before the surface*/
+	m_deletion_queue.flush();
+
 	for (auto& siv : m_swapchain_image_views)
 	{
 		vkDestroyImageView(m_device, siv, VK_NULL_HANDLE);
@@ -251,6 +822,7 @@ void VulkanEngine::DeinitSurfaceDependentObjects()
 	if (m_swapchain != VK_NULL_HANDLE)
 	{
 		vkDestroySwapchainKHR(m_device, m_swapchain, VK_NULL_HANDLE);
+		m_swapchain = VK_NULL_HANDLE;
 	}
 
 	if (m_surface != VK_NULL_HANDLE)
@@ -273,6 +845,9 @@ bool VulkanEngine::InitSwapchain()
 	VkSurfaceFormatKHR surface_format;
 	VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
 	uint32_t image_count;
+	VkExtent2D extent;
+	
+	const PresentPolicy policy = settings().present_policy;
 
 	res = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(m_physical_device, m_surface, &surface_capabilities);
 	if (res < 0)
@@ -283,15 +858,32 @@ bool VulkanEngine::InitSwapchain()
 	
 	if (surface_capabilities.currentExtent.width == UINT32_MAX)
 	{
-		m_surface_extent.width = m_window->getWidth();
-		m_surface_extent.height = m_window->getHeight();
+		extent.width = m_window->getWidth();
+		extent.height = m_window->getHeight();
 	}
 	else
 	{
-		m_surface_extent = surface_capabilities.currentExtent;
+		extent = surface_capabilities.currentExtent;
 	}
+
+	/*a minimized window has no area to present to, keep the current swapchain until it has*/
+	if (extent.width == 0 || extent.height == 0)
+		return false;
+
+	m_surface_extent = extent;
 	
-	image_count = surface_capabilities.minImageCount + 1;
+	/*a mailbox needs a spare image to keep rendering while one is queued and one is displayed,
+	the other policies gain latency from every extra image*/
+	if (settings().swapchain_image_count != 0)
+		image_count = settings().swapchain_image_count;
+	else if (policy == PresentPolicy::MaxThroughput)
+		image_count = surface_capabilities.minImageCount + 1;
+	else
+		image_count = surface_capabilities.minImageCount;
+	
+	image_count = std::max(image_count, surface_capabilities.minImageCount);
+	if (surface_capabilities.maxImageCount != 0)
+		image_count = std::min(image_count, surface_capabilities.maxImageCount);
 
 	uint32_t surface_format_count = 0;
 	vkGetPhysicalDeviceSurfaceFormatsKHR(m_physical_device, m_surface, &surface_format_count, VK_NULL_HANDLE);
@@ -325,15 +917,25 @@ bool VulkanEngine::InitSwapchain()
 		return false;
 	}
 
-	for (auto pm : present_modes)
+	std::vector<VkPresentModeKHR> preferred_modes;
+	switch (policy)
 	{
-		if(pm == VK_PRESENT_MODE_MAILBOX_KHR)
-		{
-			present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
-			break;
-		}
+	case PresentPolicy::LowestLatency:
+		preferred_modes = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR};
+		break;
+	case PresentPolicy::MaxThroughput:
+		preferred_modes = {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR};
+		break;
+	case PresentPolicy::PowerSaving:
+		preferred_modes = {VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+		break;
 	}
 
+	/*FIFO is the only mode every implementation has to support*/
+	auto preferred = std::find_first_of(preferred_modes.begin(), preferred_modes.end(), present_modes.begin(), present_modes.end());
+	if (preferred != preferred_modes.end())
+		present_mode = *preferred;
+
 	VkSwapchainCreateInfoKHR swapchain_create_info{};
 	swapchain_create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
 	swapchain_create_info.surface = m_surface;
@@ -346,17 +948,46 @@ bool VulkanEngine::InitSwapchain()
 	swapchain_create_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	swapchain_create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 	swapchain_create_info.minImageCount = image_count;
-	swapchain_create_info.oldSwapchain = VK_NULL_HANDLE;
+	swapchain_create_info.oldSwapchain = m_swapchain;
 	swapchain_create_info.presentMode = present_mode;
 	swapchain_create_info.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
 
-	res = vkCreateSwapchainKHR(m_device, &swapchain_create_info, VK_NULL_HANDLE, &m_swapchain);
+	VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+	res = vkCreateSwapchainKHR(m_device, &swapchain_create_info, VK_NULL_HANDLE, &swapchain);
+
+	/*the old swapchain is retired even if creation failed, its images may still be in use
+	by frames in flight, so it is destroyed only once those frames completed*/
+	if (m_swapchain != VK_NULL_HANDLE)
+	{
+		VkDevice device = m_device;
+		destroyLater([device, old_swapchain = m_swapchain, image_views = m_swapchain_image_views]
+		{
+			for (auto& siv : image_views)
+			{
+				vkDestroyImageView(device, siv, VK_NULL_HANDLE);
+			}
+
+			vkDestroySwapchainKHR(device, old_swapchain, VK_NULL_HANDLE);
+		});
+		m_swapchain = VK_NULL_HANDLE;
+		m_swapchain_image_views.clear();
+		m_swapchain_images.clear();
+	}
+
 	if (res < 0)
 	{
 		ErrorMessage("Error: Failed to create swapchain.", res);
 		return false;
 	}
 
+	m_swapchain = swapchain;
+	
+	/*resizes keep the configuration, report only what the policy changed*/
+	if (present_mode != m_present_mode || image_count != m_swapchain_min_image_count)
+		cout << "Swapchain present mode: " << PresentModeToString(present_mode) << ", " << image_count << " images requested\n";
+	m_present_mode = present_mode;
+	m_swapchain_min_image_count = image_count;
+
 	uint32_t swapchain_image_count;
 	vkGetSwapchainImagesKHR(m_device, m_swapchain, &swapchain_image_count, VK_NULL_HANDLE);
 	m_swapchain_images.resize(swapchain_image_count);
@@ -395,11 +1026,277 @@ bool VulkanEngine::InitSwapchain()
 	return true;
 }
 
+bool VulkanEngine::InitVirtualSwapchain()
+{
+	VkResult res;
+	
+	m_surface_extent = settings().headless_extent;
+	m_surface_format = VK_FORMAT_R8G8B8A8_UNORM;
+	
+	/*Images stand in for swapchain images, they are rendered to and then only read back by transfers*/
+	VkImageCreateInfo image_create_info{};
+	image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_create_info.pNext = NULL;
+	image_create_info.flags = 0;
+	image_create_info.imageType = VK_IMAGE_TYPE_2D;
+	image_create_info.format = m_surface_format;
+	image_create_info.extent = VkExtent3D{m_surface_extent.width, m_surface_extent.height, 1};
+	image_create_info.mipLevels = 1;
+	image_create_info.arrayLayers = 1;
+	image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_create_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	
+	VkImageViewCreateInfo image_view_create_info{};
+	image_view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	image_view_create_info.components = { VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY };
+	image_view_create_info.format = m_surface_format;
+	image_view_create_info.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+	image_view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	
+	uint32_t image_count = settings().headless_image_count;
+	m_swapchain_images.resize(image_count, VK_NULL_HANDLE);
+	m_swapchain_image_views.resize(image_count, VK_NULL_HANDLE);
+	m_virtual_image_memory.resize(image_count);
+	
+	for (uint32_t i = 0; i < image_count; i++)
+	{
+		res = vkCreateImage(m_device, &image_create_info, VK_NULL_HANDLE, &m_swapchain_images[i]);
+		if (res < 0)
+		{
+			ErrorMessage("Error: Failed to create virtual swapchain image.", res);
+			return false;
+		}
+		
+		if (!m_allocator.allocateImage(m_swapchain_images[i], VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, MemoryTag::Swapchain, m_virtual_image_memory[i]))
+		{
+			ErrorMessage("Error: Failed to allocate virtual swapchain image memory.");
+			return false;
+		}
+		
+		image_view_create_info.image = m_swapchain_images[i];
+		res = vkCreateImageView(m_device, &image_view_create_info, VK_NULL_HANDLE, &m_swapchain_image_views[i]);
+		if (res < 0)
+		{
+			ErrorMessage("Error: Failed to create virtual swapchain image views.", res);
+			return false;
+		}
+	}
+	
+	m_virtual_image_index = 0;
+	
+	return true;
+}
+
+void VulkanEngine::DeinitVirtualSwapchain()
+{
+	for (auto& siv : m_swapchain_image_views)
+	{
+		if (siv != VK_NULL_HANDLE)
+			vkDestroyImageView(m_device, siv, VK_NULL_HANDLE);
+	}
+	
+	for (auto& si : m_swapchain_images)
+	{
+		if (si != VK_NULL_HANDLE)
+			vkDestroyImage(m_device, si, VK_NULL_HANDLE);
+	}
+	
+	for (auto& mem : m_virtual_image_memory)
+	{
+		m_allocator.free(mem);
+	}
+	
+	m_swapchain_image_views.clear();
+	m_swapchain_images.clear();
+	m_virtual_image_memory.clear();
+}
+
+VkResult VulkanEngine::acquireNextImage(VkSemaphore signal, uint32_t* image_index)
+{
+	/*the scene waits for the fence of frame N - frames_in_flight before acquiring frame N,
+	so anything last used by that frame or earlier is no longer in use by the device.
+	An acquire that fails submits nothing, the serial only advances in present()*/
+	uint64_t frames_in_flight = std::max(1u, settings().frames_in_flight);
+	if (m_frame_serial > frames_in_flight)
+		m_deletion_queue.collect(m_frame_serial - frames_in_flight);
+
+	if (!settings().headless)
+	{
+		if (m_swapchain_dirty || m_swapchain == VK_NULL_HANDLE)
+		{
+			if (!RecreateSwapchain())
+				return VK_ERROR_OUT_OF_DATE_KHR;
+		}
+
+		VkResult res = m_vk.vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, signal, VK_NULL_HANDLE, image_index);
+
+		/*nothing was signalled, so the same semaphore can be used again on the new swapchain*/
+		if (res == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			if (!RecreateSwapchain())
+				return res;
+
+			res = m_vk.vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, signal, VK_NULL_HANDLE, image_index);
+		}
+
+		/*still usable, recreate once this frame is on its way*/
+		if (res == VK_SUBOPTIMAL_KHR)
+			m_swapchain_dirty = true;
+
+		return res;
+	}
+	
+	/*hand out the virtual images in ring order, the semaphore is signalled by an empty batch
+	so the scene can wait on it exactly as it would on a real acquire*/
+	*image_index = m_virtual_image_index;
+	m_virtual_image_index = (m_virtual_image_index + 1) % m_swapchain_images.size();
+	
+	VkSubmitInfo submit_info{};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.signalSemaphoreCount = 1;
+	submit_info.pSignalSemaphores = &signal;
+	
+	return m_vk.vkQueueSubmit(m_queue_general, 1, &submit_info, VK_NULL_HANDLE);
+}
+
+VkResult VulkanEngine::present(VkSemaphore wait, uint32_t image_index)
+{
+	/*the frame was submitted, objects retired from here on may still be used by the next one*/
+	m_frame_serial++;
+	m_vk.endFrame();
+	
+	if (!settings().headless)
+	{
+		VkPresentInfoKHR present_info{};
+		present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		present_info.pNext = NULL;
+		present_info.pImageIndices = &image_index;
+		present_info.pResults = NULL;
+		present_info.swapchainCount = 1;
+		present_info.pSwapchains = &m_swapchain;
+		present_info.waitSemaphoreCount = 1;
+		present_info.pWaitSemaphores = &wait;
+		
+		VkResult res = m_vk.vkQueuePresentKHR(m_queue_general, &present_info);
+		
+		if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR)
+			m_swapchain_dirty = true;
+		
+		return res;
+	}
+	
+	/*nothing to present to, just consume the semaphore so it can be signalled again*/
+	VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	
+	VkSubmitInfo submit_info{};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.waitSemaphoreCount = 1;
+	submit_info.pWaitSemaphores = &wait;
+	submit_info.pWaitDstStageMask = &wait_stage;
+	
+	m_headless_frames++;
+	if (settings().headless_frame_count != 0 && m_headless_frames >= settings().headless_frame_count)
+		stop();
+	
+	return m_vk.vkQueueSubmit(m_queue_general, 1, &submit_info, VK_NULL_HANDLE);
+}
+
 const VkDevice& VulkanEngine::getDevice() const noexcept
 {
 	return m_device;
 }
 
+VkQueue VulkanEngine::getQueueGeneral() const noexcept
+{
+	return m_queue_general;
+}
+
+VkQueue VulkanEngine::getQueueTransfer() const noexcept
+{
+	return m_queue_transfer;
+}
+
+VulkanTransfer& VulkanEngine::getTransfer() noexcept
+{
+	return m_transfer;
+}
+
+VulkanAllocator& VulkanEngine::getAllocator() noexcept
+{
+	return m_allocator;
+}
+
+DeviceDispatch& VulkanEngine::getDispatch() noexcept
+{
+	return m_vk;
+}
+
+JobSystem& VulkanEngine::getJobs() noexcept
+{
+	return m_jobs;
+}
+
+void VulkanEngine::printMemoryReport()
+{
+	constexpr double MiB = 1024.0 * 1024.0;
+
+	VkDeviceSize budget[VK_MAX_MEMORY_HEAPS] = {};
+	VkDeviceSize usage[VK_MAX_MEMORY_HEAPS] = {};
+	bool has_budget = false;
+
+#ifdef VK_EXT_memory_budget
+	if (m_memory_budget_enabled)
+	{
+		auto get_memory_properties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)
+			vkGetInstanceProcAddr(m_instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+
+		if (get_memory_properties2 != NULL)
+		{
+			VkPhysicalDeviceMemoryBudgetPropertiesEXT budget_props = {};
+			budget_props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+			budget_props.pNext = NULL;
+
+			VkPhysicalDeviceMemoryProperties2KHR mem_props2 = {};
+			mem_props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+			mem_props2.pNext = &budget_props;
+
+			get_memory_properties2(m_physical_device, &mem_props2);
+
+			for (uint32_t h = 0; h < VK_MAX_MEMORY_HEAPS; h++)
+			{
+				budget[h] = budget_props.heapBudget[h];
+				usage[h] = budget_props.heapUsage[h];
+			}
+			has_budget = true;
+		}
+	}
+#endif//VK_EXT_memory_budget
+
+	m_allocator.printStatistics();
+
+	for (uint32_t h = 0; h < m_physical_device_memory_properties.memoryHeapCount; h++)
+	{
+		const VkMemoryHeap& heap = m_physical_device_memory_properties.memoryHeaps[h];
+
+		cout << "Heap " << h << ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " (device local)" : "")
+			<< ": size " << heap.size / MiB << " MiB, engine " << m_allocator.getHeapUsage(h) / MiB << " MiB";
+
+		if (has_budget)
+		{
+			cout << ", process " << usage[h] / MiB << " MiB of " << budget[h] / MiB << " MiB budget";
+			if (usage[h] > budget[h])
+				cout << " (over budget)";
+		}
+		cout << '\n';
+	}
+
+	if (!has_budget)
+		cout << "VK_EXT_memory_budget is not available, heap budgets unknown\n";
+}
+
 std::unique_ptr<VulkanWindow>& VulkanEngine::getWindow()
 {
 	return m_window;
@@ -430,6 +1327,16 @@ const VkPhysicalDeviceMemoryProperties& VulkanEngine::getPhyDevMemProps() const
 	return m_physical_device_memory_properties;
 }
 
+const VkPhysicalDeviceProperties& VulkanEngine::getPhyDevProps() const noexcept
+{
+	return m_physical_device_properties;
+}
+
+VkPhysicalDevice VulkanEngine::getPhysicalDevice() const noexcept
+{
+	return m_physical_device;
+}
+
 VkFormat VulkanEngine::getSurfaceFormat() const noexcept
 {
 	return m_surface_format;
@@ -440,6 +1347,22 @@ VkExtent2D VulkanEngine::getSurfaceExtent() const noexcept
 	return m_surface_extent;
 }
 
+VkImageLayout VulkanEngine::getPresentLayout() const noexcept
+{
+	/*virtual swapchain images are never presented, leave them ready for readback instead*/
+	return settings().headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+}
+
+VkPresentModeKHR VulkanEngine::getPresentMode() const noexcept
+{
+	return m_present_mode;
+}
+
+bool VulkanEngine::isHeadless() const noexcept
+{
+	return settings().headless;
+}
+
 uint32_t VulkanEngine::getQueueFamilyIndexGeneral()
 {
 	return m_queue_family_index_general;
@@ -458,6 +1381,13 @@ void VulkanEngine::setScene(std::shared_ptr<Scene> scene)
 void VulkanEngine::render()
 {
 	m_scene->render();
+	
+	/*the first frame has been queued for presentation, startup is over*/
+	if (!m_first_frame_reported)
+	{
+		m_first_frame_reported = true;
+		startupTimes().print("Time to first frame");
+	}
 }
 
 void VulkanEngine::run()
@@ -465,23 +1395,92 @@ void VulkanEngine::run()
 	if(m_scene.get() == nullptr)
 		return;
 	
+	if (settings().headless)
+	{
+		runHeadless();
+		return;
+	}
+	
 	m_window->show();
 	m_scene->getTimer().reset();
 
+	std::thread render_thread(&VulkanEngine::renderLoop, this);
+
+	/*the window thread only pumps events, a slow frame never delays input or resize handling*/
 	while (m_running)
 	{
-		if(!m_window->manageEvents(m_scene->getInputManager()))
+		if (m_window->manageEvents(m_scene->getInputManager()))
+			wake();
+
+		if (m_running)
+			m_window->waitEvents(settings().idle_timeout_ms);
+	}
+
+	wake();
+	render_thread.join();
+}
+
+void VulkanEngine::renderLoop()
+{
+	InputManager& input = m_scene->getInputManager();
+	Timer& timer = m_scene->getTimer();
+
+	while (m_running)
+	{
+		/*input phase: everything queued since the last frame is handled before the frame is built*/
+		input.DispatchInput();
+
+		/*a hidden window stops the clock so the scene does not jump ahead when it shows up again*/
+		bool visible = m_window->isVisible();
+		if (!visible && !timer.isPaused())
 		{
-			if (!m_scene->getTimer().isPaused())
-			{
-				m_scene->getTimer().tick();
-				
-				render();
-			}
+			timer.stop();
+			m_hidden_paused = true;
+		}
+		else if (visible && m_hidden_paused)
+		{
+			timer.start();
+			m_hidden_paused = false;
+		}
+
+		if (timer.isPaused())
+		{
+			/*nothing to draw, sleep until the window thread has new events*/
+			std::unique_lock<std::mutex> lock(m_wake_mutex);
+			m_wake_cv.wait_for(lock, std::chrono::milliseconds(settings().idle_timeout_ms), [this] { return m_wake_pending; });
+			m_wake_pending = false;
+			continue;
 		}
+
+		timer.tick();
+			
+		render();
 	};
 }
 
+void VulkanEngine::runHeadless()
+{
+	m_scene->getTimer().reset();
+	
+	auto start = std::chrono::steady_clock::now();
+	
+	while (m_running)
+	{
+		m_scene->getTimer().tick();
+		
+		render();
+	}
+	
+	m_vk.vkQueueWaitIdle(m_queue_general);
+	
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	
+	cout << "Headless run: " << m_headless_frames << " frames in " << elapsed.count() << " s";
+	if (elapsed.count() > 0.0)
+		cout << " (" << m_headless_frames / elapsed.count() << " fps)";
+	cout << endl;
+}
+
 #ifdef VK_USE_PLATFORM_WIN32_KHR
 
 bool VulkanEngine::InitSurface()
@@ -5,52 +5,163 @@
 #include <vulkan.h>
 #include <memory>
 #include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #include "gui.h"
 #include "Timer.h"
 #include "Scene.h"
+#include "transfer.h"
+#include "allocator.h"
+#include "jobs.h"
+#include "deletion_queue.h"
+#include "dispatch.h"
+
+/*Trade-off between input latency, frame rate and power used when choosing the present mode*/
+enum class PresentPolicy
+{
+	LowestLatency,	//IMMEDIATE, then MAILBOX, with the minimal image count
+	MaxThroughput,	//MAILBOX, then IMMEDIATE, with one image more than the minimum
+	PowerSaving		//FIFO_RELAXED, then FIFO, frame rate capped by the display
+};
+
+/*Engine configuration, must be filled in before the first call to VulkanEngine::get()*/
+struct EngineSettings
+{
+	/*Render without a window, surface or swapchain, into a ring of device local images*/
+	bool headless = false;
+	VkExtent2D headless_extent{1920, 1080};
+	uint32_t headless_image_count = 3;
+	/*Number of frames rendered in headless mode before stopping, 0 runs until stop() is called*/
+	uint32_t headless_frame_count = 0;
+	
+	/*Number of frames the CPU may record ahead of the GPU*/
+	uint32_t frames_in_flight = 2;
+	
+	/*Present mode policy, FIFO is used when none of the preferred modes is supported*/
+	PresentPolicy present_policy = PresentPolicy::MaxThroughput;
+	/*Requested swapchain image count, 0 uses the policy default, clamped to the surface limits*/
+	uint32_t swapchain_image_count = 0;
+	
+	/*Job system worker threads, 0 uses one per hardware thread but the calling one*/
+	uint32_t worker_count = 0;
+	
+	/*Longest time the render loop sleeps waiting for events while paused or hidden*/
+	uint32_t idle_timeout_ms = 250;
+	
+	/*File the pipeline cache is loaded from at startup and saved to on shutdown, empty disables persistence*/
+	std::string pipeline_cache_path = "pipeline_cache.bin";
+	
+	/*Physical device to use instead of the best scoring one, matched against a part of the device name
+	or the hex pipelineCacheUUID, the VULKAN001_DEVICE environment variable takes precedence*/
+	std::string device_override;
+	/*Features the scene depends on, only these are enabled, devices lacking any of them are skipped*/
+	VkPhysicalDeviceFeatures required_features{};
+};
+
+struct PipelineCacheStats
+{
+	std::atomic<uint32_t> hits{0};
+	std::atomic<uint32_t> misses{0};
+	std::atomic<uint64_t> creation_us{0};
+	size_t loaded_size = 0;
+};
 
 class VulkanEngine
 {
 public:
 	static VulkanEngine& get();
+	static EngineSettings& settings();
+	/*Startup stages of the engine, the scene and main, timed from the first access*/
+	static StageTimes& startupTimes();
 	~VulkanEngine();
 
+	/*The calling thread pumps window events, update/record/submit/present run on a render thread*/
 	void run();
 	void stop();
+	/*Wakes the render thread up while it idles*/
+	void wake();
 
 	void onResize();
+	/*Takes effect on the next acquire, only the swapchain is recreated*/
+	void setPresentPolicy(PresentPolicy policy, uint32_t image_count = 0);
+	
+	/*Runs fn once the frames that may still use its objects completed, tagged with the current frame*/
+	void destroyLater(std::function<void()> fn);
+	
+	/*Swapchain image acquisition and presentation, internal ring operations in headless mode*/
+	VkResult acquireNextImage(VkSemaphore signal, uint32_t* image_index);
+	VkResult present(VkSemaphore wait, uint32_t image_index);
 	
 	void setScene(std::shared_ptr<Scene>);
+	
+	/*Pipeline creation through the engine owned, persistent pipeline cache*/
+	VkResult createGraphicsPipelines(uint32_t count, const VkGraphicsPipelineCreateInfo* create_infos, VkPipeline* pipelines);
+	VkResult createComputePipelines(uint32_t count, const VkComputePipelineCreateInfo* create_infos, VkPipeline* pipelines);
+	VkPipelineCache getPipelineCache() const noexcept;
+	const PipelineCacheStats& getPipelineCacheStats() const noexcept;
 
 	std::unique_ptr<VulkanWindow>& getWindow();
 	InputManager& getInputManager();
 	
 	const VkDevice& getDevice() const noexcept;
+	VkQueue getQueueGeneral() const noexcept;
+	VkQueue getQueueTransfer() const noexcept;
+	/*Asynchronous uploads and readbacks on the transfer queue*/
+	VulkanTransfer& getTransfer() noexcept;
+	/*Sub-allocated device memory for every resource*/
+	VulkanAllocator& getAllocator() noexcept;
+	/*Device functions loaded for this device, the per frame API call counts are kept here as well*/
+	DeviceDispatch& getDispatch() noexcept;
+	/*Work-stealing thread pool for CPU work of the engine and the scene*/
+	JobSystem& getJobs() noexcept;
+	/*Prints per subsystem memory usage and, where VK_EXT_memory_budget is available, the heap budgets*/
+	void printMemoryReport();
 	const VkSwapchainKHR& getSwapchain() const noexcept;
 	const std::vector<VkImageView>& getSwapchainImageViews()const noexcept;
 	const std::vector<VkImage>& getSwapchainImages() const noexcept;
 	const VkPhysicalDeviceMemoryProperties& getPhyDevMemProps() const noexcept;
+	const VkPhysicalDeviceProperties& getPhyDevProps() const noexcept;
+	VkPhysicalDevice getPhysicalDevice() const noexcept;
 	
 	VkFormat getSurfaceFormat() const noexcept;
 	VkExtent2D getSurfaceExtent() const noexcept;
+	VkImageLayout getPresentLayout() const noexcept;
+	VkPresentModeKHR getPresentMode() const noexcept;
+	bool isHeadless() const noexcept;
 	uint32_t getQueueFamilyIndexGeneral();
 	uint32_t getQueueFamilyIndexTransfer();
 	
 private:
 	VulkanEngine();
 	void render();
+	void runHeadless();
+	void renderLoop();
 
 	void EnableLayersAndExtensions();
 
+	/*creation feedback or cache growth decides hit or miss, for either kind of pipeline*/
+	template<typename CreateInfo, typename CreateFn>
+	VkResult CreatePipelines(uint32_t count, const CreateInfo* create_infos, VkPipeline* pipelines, CreateFn create);
+
 	bool InitInstance();
 	bool InitDevice();
+	bool SelectPhysicalDevice();
+	int64_t ScorePhysicalDevice(VkPhysicalDevice device, std::string& reason) const;
+	bool MatchesDeviceOverride(VkPhysicalDevice device, const std::string& device_override) const;
+	bool InitPipelineCache();
+	void DeinitPipelineCache();
 
 	//SURFACE DEPENDENT-----------------------------------
 	bool InitSurfaceDependentObjects();
 	void DeinitSurfaceDependentObjects();
 	bool InitSurface();
 	bool InitSwapchain();
+	bool RecreateSwapchain();
+	bool InitVirtualSwapchain();
+	void DeinitVirtualSwapchain();
 
 	void InitDebug();
 	void DeInitDebug();
@@ -71,18 +182,31 @@ private:
 	
 	//INSTANCE---------------------------------------------------------------------
 	VkInstance m_instance = VK_NULL_HANDLE;
+	bool m_properties2_enabled = false;
 
 	//PHYSICAL DEVICE--------------------------------------------------------------
 	VkPhysicalDevice m_physical_device = VK_NULL_HANDLE;
 
 	VkPhysicalDeviceProperties m_physical_device_properties;
 	VkPhysicalDeviceFeatures m_physical_device_features;
+	VkPhysicalDeviceFeatures m_enabled_features{};
 	VkPhysicalDeviceMemoryProperties m_physical_device_memory_properties;
 
 	//DEVICE-----------------------------------------------------------------------
 	VkDevice m_device = VK_NULL_HANDLE;
+	DeviceDispatch m_vk;
 	uint32_t m_queue_family_index_general = -1;
 	uint32_t m_queue_family_index_transfer = -1;
+	VkQueue m_queue_general = VK_NULL_HANDLE;
+	VkQueue m_queue_transfer = VK_NULL_HANDLE;
+	VulkanTransfer m_transfer;
+	VulkanAllocator m_allocator;
+	bool m_creation_feedback_enabled = false;
+	bool m_memory_budget_enabled = false;
+
+	//PIPELINE CACHE---------------------------------------------------------------
+	VkPipelineCache m_pipeline_cache = VK_NULL_HANDLE;
+	PipelineCacheStats m_pipeline_cache_stats;
 
 	///////////////////////////////////////////////////////////////////////////////
 	///////////////				SURFACE DEPENDENT					///////////////
@@ -93,15 +217,38 @@ private:
 
 	VkExtent2D m_surface_extent;
 	VkFormat m_surface_format;
+	VkPresentModeKHR m_present_mode = VK_PRESENT_MODE_FIFO_KHR;
+	uint32_t m_swapchain_min_image_count = 0;
 
 	VkSwapchainKHR m_swapchain = VK_NULL_HANDLE;
 	std::vector<VkImage> m_swapchain_images;
 	std::vector<VkImageView> m_swapchain_image_views;
+	/*set from the window thread on resize*/
+	std::atomic<bool> m_swapchain_dirty{false};
+	
+	/*objects replaced while frames in flight may still use them, swapchains and scene resources*/
+	DeletionQueue m_deletion_queue;
+	/*serial of the frame being recorded, frames are counted once submitted*/
+	uint64_t m_frame_serial = 1;
+	
+	//HEADLESS---------------------------------------------------------------------
+	std::vector<Allocation> m_virtual_image_memory;
+	uint32_t m_virtual_image_index = 0;
+	uint64_t m_headless_frames = 0;
 	
 	std::unique_ptr<VulkanWindow> m_window;
 	std::shared_ptr<Scene> m_scene;
+	JobSystem m_jobs;
 	
-	bool m_running = true;
+	std::atomic<bool> m_running{true};
+	bool m_first_frame_reported = false;
+	/*the timer was stopped because the window got hidden, not by the user*/
+	bool m_hidden_paused = false;
+
+	/*the idle render thread sleeps until the window thread has something for it*/
+	std::mutex m_wake_mutex;
+	std::condition_variable m_wake_cv;
+	bool m_wake_pending = false;
 };
 
 #endif //ENGINE_H
\ No newline at end of file
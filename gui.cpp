@@ -4,9 +4,15 @@
 #include "engine.h"
 #include <stdio.h>
 
+#ifdef VK_USE_PLATFORM_XCB_KHR
+#include <poll.h>
+#endif
+
 InputManager::sKeyStateBuffer InputManager::KeyStateBuffer;
 uint16_t InputManager::lastMouseX;
 uint16_t InputManager::lastMouseY;
+InputManager::sPendingMotion InputManager::PendingMotion;
+SpscQueue<InputEvent, 1024> InputManager::Events;
 
 std::pair<float, float> VulkanWindow::getCursorPosNDC()
 {
@@ -34,6 +40,82 @@ bool InputManager::getKeyState(keycode_t k) noexcept
 	return KeyStateBuffer.keyboard[k];
 }
 
+void InputManager::QueueMotion(int32_t dx, int32_t dy, bool dragged)
+{
+	/*a button changed in between, deliver what was moved before it*/
+	if (PendingMotion.pending && PendingMotion.dragged != dragged)
+		FlushMotion();
+
+	PendingMotion.dx += dx;
+	PendingMotion.dy += dy;
+	PendingMotion.dragged = dragged;
+	PendingMotion.pending = true;
+}
+
+void InputManager::FlushMotion()
+{
+	if (!PendingMotion.pending)
+		return;
+
+	sPendingMotion motion = PendingMotion;
+	PendingMotion = sPendingMotion();
+
+	if (motion.dx == 0 && motion.dy == 0)
+		return;
+
+	auto clamp = [](int32_t d) { return (int16_t)(d < INT16_MIN ? INT16_MIN : (d > INT16_MAX ? INT16_MAX : d)); };
+
+	PostEvent(motion.dragged ? InputEvent::Type::MouseDragged : InputEvent::Type::MouseMoved, 0, 0, clamp(motion.dx), clamp(motion.dy));
+}
+
+void InputManager::PostEvent(InputEvent::Type type, keycode_t key, mbflag_t button, int16_t dx, int16_t dy)
+{
+	InputEvent e;
+	e.type = type;
+	e.key = key;
+	e.button = button;
+	e.dx = dx;
+	e.dy = dy;
+
+	/*the render thread is more than a thousand events behind, the key state is still up to date*/
+	Events.push(e);
+}
+
+void InputManager::DispatchInput()
+{
+	InputEvent e;
+	while (Events.pop(e))
+	{
+		switch (e.type)
+		{
+		case InputEvent::Type::MousePressed:
+			MousePressed(e.button);
+			break;
+		case InputEvent::Type::MouseReleased:
+			MouseReleased(e.button);
+			break;
+		case InputEvent::Type::MouseScrolledUp:
+			MouseScrolledUp();
+			break;
+		case InputEvent::Type::MouseScrolledDown:
+			MouseScrolledDown();
+			break;
+		case InputEvent::Type::MouseMoved:
+			MouseMoved(e.dx, e.dy);
+			break;
+		case InputEvent::Type::MouseDragged:
+			MouseDragged(e.dx, e.dy);
+			break;
+		case InputEvent::Type::KeyPressed:
+			KeyPressed(e.key);
+			break;
+		case InputEvent::Type::KeyReleased:
+			KeyReleased(e.key);
+			break;
+		}
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////					W I N  3 2					///////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -84,65 +166,84 @@ void InputManager::ManageInput(std::unique_ptr<input_t, std::function<void(input
 {	
 	//Manage keyboard input
 	if (raw->header.dwType == RIM_TYPEKEYBOARD)
-	{		
+	{
+		FlushMotion();
+		
 		if (raw->data.keyboard.Flags == RI_KEY_E0 || raw->data.keyboard.Flags == RI_KEY_MAKE)
 		{
 			InputManager::KeyStateBuffer.keyboard[raw->data.keyboard.VKey] = true;
-			KeyPressed(raw->data.keyboard.VKey);
+			PostEvent(InputEvent::Type::KeyPressed, raw->data.keyboard.VKey);
 		}
 		else if (raw->data.keyboard.Flags == RI_KEY_BREAK)
 		{
 			InputManager::KeyStateBuffer.keyboard[raw->data.keyboard.VKey] = false;
-			KeyReleased(raw->data.keyboard.VKey);
+			PostEvent(InputEvent::Type::KeyReleased, raw->data.keyboard.VKey);
 		}
 	}
 	//Manage mouse input
 	else if (raw->header.dwType == RIM_TYPEMOUSE)
 	{
+		//deliver motion preceding a button change before the change itself
+		if (raw->data.mouse.usButtonFlags != 0)
+			FlushMotion();
+
 		//update keystate buffers
 		switch (raw->data.mouse.usButtonFlags)
 		{
 		case RI_MOUSE_LEFT_BUTTON_DOWN:
 			InputManager::KeyStateBuffer.mouse |= LMB;
-			MousePressed(LMB);
+			PostEvent(InputEvent::Type::MousePressed, 0, LMB);
 			break;
 		case RI_MOUSE_LEFT_BUTTON_UP:
 			InputManager::KeyStateBuffer.mouse &= ~LMB;
-			MouseReleased(LMB);
+			PostEvent(InputEvent::Type::MouseReleased, 0, LMB);
 			break;
 		case RI_MOUSE_RIGHT_BUTTON_DOWN:
 			InputManager::KeyStateBuffer.mouse |= RMB;
-			MousePressed(RMB);
+			PostEvent(InputEvent::Type::MousePressed, 0, RMB);
 			break;
 		case RI_MOUSE_RIGHT_BUTTON_UP:
 			InputManager::KeyStateBuffer.mouse &= ~RMB;
-			MouseReleased(RMB);
+			PostEvent(InputEvent::Type::MouseReleased, 0, RMB);
 			break;
 		default:
 			break;
 		}
 
 		if (raw->data.mouse.lLastX != 0 || raw->data.mouse.lLastY != 0)
-		{
-			if (InputManager::KeyStateBuffer.mouse != 0)
-				MouseDragged(raw->data.mouse.lLastX, raw->data.mouse.lLastY);
-			else
-				MouseMoved(raw->data.mouse.lLastX, raw->data.mouse.lLastY);
-		}
+			QueueMotion(raw->data.mouse.lLastX, raw->data.mouse.lLastY, InputManager::KeyStateBuffer.mouse != 0);
 	}
 }
 
 bool VulkanWindow::manageEvents(InputManager& im)
 {
-	//poll for a message and return if there are none
+	//drain the message queue, raw mouse input is accumulated by the input manager
 	MSG msg;
-	if(!PeekMessage(&msg, NULL, NULL, NULL, PM_REMOVE))
-		return false;
-	
-	TranslateMessage(&msg);
-	DispatchMessage(&msg);
-	
-	return true;
+	bool any = false;
+	while (PeekMessage(&msg, NULL, NULL, NULL, PM_REMOVE))
+	{
+		if (msg.message == WM_QUIT)
+			VulkanEngine::get().stop();
+
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+		any = true;
+	}
+
+	im.FlushMotion();
+
+	return any;
+}
+
+bool VulkanWindow::waitEvents(uint32_t timeout_ms)
+{
+	//sleeps until any message is posted to the thread's queue
+	return MsgWaitForMultipleObjects(0, NULL, FALSE, timeout_ms, QS_ALLINPUT) == WAIT_OBJECT_0;
+}
+
+bool VulkanWindow::isVisible() const noexcept
+{
+	return IsWindowVisible(m_params.hwnd) && !IsIconic(m_params.hwnd);
 }
 
 std::pair<int16_t, int16_t> VulkanWindow::getCursorPosWin()
@@ -260,7 +361,13 @@ uint32_t VulkanWindow::getHeight() const noexcept
 
 void InputManager::ManageInput(std::unique_ptr<input_t, std::function<void(input_t*)>>&& input)
 {
-	switch(input->response_type)
+	uint8_t type = input->response_type & ~0x80;
+
+	/*deliver motion preceding a button or key event before the event itself*/
+	if (type != XCB_MOTION_NOTIFY)
+		FlushMotion();
+
+	switch(type)
 	{
 		case XCB_BUTTON_PRESS:
 		{
@@ -270,21 +377,21 @@ void InputManager::ManageInput(std::unique_ptr<input_t, std::function<void(input
 			{
 				case 1: //lmb
 				InputManager::KeyStateBuffer.mouse |= LMB;
-				MousePressed(LMB);
+				PostEvent(InputEvent::Type::MousePressed, 0, LMB);
 				break;
 				case 2: //scroll press
 				InputManager::KeyStateBuffer.mouse |= MMB;
-				MousePressed(MMB);
+				PostEvent(InputEvent::Type::MousePressed, 0, MMB);
 				break;
 				case 3: //rmb
 				InputManager::KeyStateBuffer.mouse |= RMB;
-				MousePressed(RMB);
+				PostEvent(InputEvent::Type::MousePressed, 0, RMB);
 				break;
 				case 4: //scroll up
-				MouseScrolledUp();
+				PostEvent(InputEvent::Type::MouseScrolledUp);
 				break;
 				case 5: //scroll down
-				MouseScrolledDown();
+				PostEvent(InputEvent::Type::MouseScrolledDown);
 				break;
 			}
 			break;
@@ -297,15 +404,15 @@ void InputManager::ManageInput(std::unique_ptr<input_t, std::function<void(input
 			{
 				case 1: //lmb
 				InputManager::KeyStateBuffer.mouse &= ~LMB;
-				MouseReleased(LMB);
+				PostEvent(InputEvent::Type::MouseReleased, 0, LMB);
 				break;
 				case 2: //scroll press
 				InputManager::KeyStateBuffer.mouse &= ~MMB;
-				MouseReleased(MMB);
+				PostEvent(InputEvent::Type::MouseReleased, 0, MMB);
 				break;
 				case 3: //rmb
 				InputManager::KeyStateBuffer.mouse &= ~RMB;
-				MouseReleased(RMB);
+				PostEvent(InputEvent::Type::MouseReleased, 0, RMB);
 				break;
 				default:
 				break;
@@ -322,10 +429,7 @@ void InputManager::ManageInput(std::unique_ptr<input_t, std::function<void(input
 			InputManager::lastMouseY = ev->event_y;
 			
 			//check state for buttons pressed
-			if (ev->state & 0x700)
-				MouseDragged(dx, dy);
-			else 
-				MouseMoved(dx, dy);
+			QueueMotion(dx, dy, (ev->state & 0x700) != 0);
 			
 			break;
 		}
@@ -334,7 +438,7 @@ void InputManager::ManageInput(std::unique_ptr<input_t, std::function<void(input
 			xcb_key_press_event_t* ev = (xcb_key_press_event_t*)input.get();
 			
 			InputManager::KeyStateBuffer.keyboard[ev->detail] = true;
-			KeyPressed(ev->detail);
+			PostEvent(InputEvent::Type::KeyPressed, ev->detail);
 			
 			break;
 		}
@@ -343,7 +447,7 @@ void InputManager::ManageInput(std::unique_ptr<input_t, std::function<void(input
 			xcb_key_release_event_t* ev = (xcb_key_release_event_t*)input.get();
 			
 			InputManager::KeyStateBuffer.keyboard[ev->detail] = false;
-			KeyReleased(ev->detail);
+			PostEvent(InputEvent::Type::KeyReleased, ev->detail);
 			
 			break;
 		}
@@ -352,41 +456,89 @@ void InputManager::ManageInput(std::unique_ptr<input_t, std::function<void(input
 
 bool VulkanWindow::manageEvents(InputManager& im)
 {
-	//poll for event
+	static auto event_del = [](input_t* p) { free(p); };
+
 	xcb_generic_event_t* e;
-	e = xcb_poll_for_event(m_params.connection);
-	
-	//return if no events
-	if (e == nullptr)
-		return false;
-		
-	switch(e->response_type)
-	{
-		case XCB_BUTTON_PRESS: 
-		case XCB_BUTTON_RELEASE:
-		case XCB_MOTION_NOTIFY:
-		case XCB_KEY_PRESS:
-		case XCB_KEY_RELEASE:
-			static auto event_del = [](input_t* p) { free(p); };
-			im.ManageInput(std::unique_ptr < input_t, decltype(event_del)> (e, event_del));
-			break;
-		//case XCB_RESIZE_REQUEST:
-			//VulkanEngine::get()->onResize();
-			//break;
-		case XCB_CONFIGURE_NOTIFY:
-		xcb_configure_notify_event_t* ev = (xcb_configure_notify_event_t*)e;
-			m_x = ev->x;
-			m_y = ev->y;
-			m_width = ev->width;
-			m_height = ev->height;
-			VulkanEngine::get().onResize();
+	bool any = false;
+	bool resized = false;
 
-			//free the event after handling
-			free(e);
+	//drain the event queue, motion is accumulated by the input manager
+	while ((e = xcb_poll_for_event(m_params.connection)) != nullptr)
+	{
+		any = true;
 
-			break;
+		switch(e->response_type & ~0x80)
+		{
+			case XCB_BUTTON_PRESS: 
+			case XCB_BUTTON_RELEASE:
+			case XCB_MOTION_NOTIFY:
+			case XCB_KEY_PRESS:
+			case XCB_KEY_RELEASE:
+				im.ManageInput(std::unique_ptr < input_t, decltype(event_del)> (e, event_del));
+				break;
+			//case XCB_RESIZE_REQUEST:
+				//VulkanEngine::get()->onResize();
+				//break;
+			case XCB_CONFIGURE_NOTIFY:
+			{
+				xcb_configure_notify_event_t* ev = (xcb_configure_notify_event_t*)e;
+				m_x = ev->x;
+				m_y = ev->y;
+				/*moving the window also generates configure events, the swapchain only cares about the size*/
+				if(m_width != ev->width || m_height != ev->height)
+				{
+					m_width = ev->width;
+					m_height = ev->height;
+					resized = true;
+				}
+
+				free(e);
+				break;
+			}
+			case XCB_MAP_NOTIFY:
+				m_mapped = true;
+				free(e);
+				break;
+			case XCB_UNMAP_NOTIFY:
+				m_mapped = false;
+				free(e);
+				break;
+			case XCB_VISIBILITY_NOTIFY:
+				m_obscured = ((xcb_visibility_notify_event_t*)e)->state == XCB_VISIBILITY_FULLY_OBSCURED;
+				free(e);
+				break;
+			default:
+				free(e);
+				break;
+		}
 	}
-	return true;
+
+	im.FlushMotion();
+
+	/*an interactive resize sends a burst of configure events, only the last size matters*/
+	if (resized)
+		VulkanEngine::get().onResize();
+
+	return any;
+}
+
+bool VulkanWindow::waitEvents(uint32_t timeout_ms)
+{
+	/*requests still in the output buffer could be what the server has to answer first*/
+	xcb_flush(m_params.connection);
+
+	/*manageEvents drained the event queue, anything new has to come through the socket*/
+	pollfd fd;
+	fd.fd = xcb_get_file_descriptor(m_params.connection);
+	fd.events = POLLIN;
+	fd.revents = 0;
+
+	return poll(&fd, 1, (int)timeout_ms) > 0;
+}
+
+bool VulkanWindow::isVisible() const noexcept
+{
+	return m_mapped && !m_obscured;
 }
 
 std::pair<int16_t, int16_t> VulkanWindow::getCursorPosWin()
@@ -410,7 +562,7 @@ VulkanWindow::VulkanWindow()
 	
 	/* Create the window */
 	uint32_t window = xcb_generate_id(connection);
-	uint32_t event_mask = XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_KEY_PRESS | XCB_EVENT_MASK_KEY_RELEASE | XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_BUTTON_RELEASE | XCB_EVENT_MASK_POINTER_MOTION | XCB_EVENT_MASK_BUTTON_MOTION;
+	uint32_t event_mask = XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_KEY_PRESS | XCB_EVENT_MASK_KEY_RELEASE | XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_BUTTON_RELEASE | XCB_EVENT_MASK_POINTER_MOTION | XCB_EVENT_MASK_BUTTON_MOTION | XCB_EVENT_MASK_VISIBILITY_CHANGE;
 	xcb_create_window(connection, XCB_COPY_FROM_PARENT, window, screen->root, 0,0,1920,1080, 10, XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, XCB_CW_EVENT_MASK, &event_mask);
 	
 	m_params.connection = connection;
@@ -5,6 +5,9 @@
 #include <memory>
 #include <vector>
 #include <functional>
+#include <atomic>
+
+#include "spsc_queue.h"
 
 class VulkanWindow;
 
@@ -12,22 +15,67 @@ constexpr const mbflag_t LMB = 1;
 constexpr const mbflag_t MMB = 2;
 constexpr const mbflag_t RMB = 4;
 
+/*Input decoded on the window thread, handed to the render thread*/
+struct InputEvent
+{
+	enum class Type : uint8_t
+	{
+		MousePressed,
+		MouseReleased,
+		MouseScrolledUp,
+		MouseScrolledDown,
+		MouseMoved,
+		MouseDragged,
+		KeyPressed,
+		KeyReleased
+	};
+
+	Type type;
+	keycode_t key = 0;
+	mbflag_t button = 0;
+	int16_t dx = 0;
+	int16_t dy = 0;
+};
+
+/*Raw input is decoded by ManageInput on the window thread, which updates the key state right away
+and queues an InputEvent. The callbacks run on the render thread from DispatchInput.*/
 class InputManager
 {
 private:
 
+	/*written by the window thread, read from anywhere*/
 	struct sKeyStateBuffer
 	{
-		std::vector<bool> keyboard = std::vector<bool>(256);
-		mbflag_t mouse;
+		std::atomic<bool> keyboard[256]{};
+		std::atomic<mbflag_t> mouse{0};
+	};
+
+	/*motion accumulated since the last button or key event*/
+	struct sPendingMotion
+	{
+		int32_t dx = 0;
+		int32_t dy = 0;
+		bool dragged = false;
+		bool pending = false;
 	};
 
 	static uint16_t lastMouseX;
 	static uint16_t lastMouseY;
 	static sKeyStateBuffer KeyStateBuffer;
+	static sPendingMotion PendingMotion;
+	static SpscQueue<InputEvent, 1024> Events;
+
+	void QueueMotion(int32_t dx, int32_t dy, bool dragged);
+	void PostEvent(InputEvent::Type type, keycode_t key = 0, mbflag_t button = 0, int16_t dx = 0, int16_t dy = 0);
 	
 public:
+	/*window thread*/
 	void ManageInput(std::unique_ptr<input_t, std::function<void(input_t*)>>&&);
+	/*Queues the accumulated motion as a single event*/
+	void FlushMotion();
+
+	/*render thread, runs the callbacks for everything queued so far*/
+	void DispatchInput();
 
 	virtual void MousePressed(mbflag_t) {}
 	virtual void MouseReleased(mbflag_t) {}
@@ -51,8 +99,13 @@ public:
 	~VulkanWindow();
 
 	void show() const;
+	//handles every pending event, consecutive mouse motion and resizes are merged
 	//returns if there were any events
 	bool manageEvents(InputManager&);
+	//blocks until an event arrives or timeout_ms passes, returns if there are events to handle
+	bool waitEvents(uint32_t timeout_ms);
+	//false while minimized, unmapped or fully covered by other windows
+	bool isVisible() const noexcept;
 	
 	std::pair<int16_t, int16_t> getCursorPosWin();
 	std::pair<float, float> getCursorPosNDC();
@@ -64,10 +117,13 @@ public:
 
 	const WindowParameters& getParams() const noexcept;
 private:
-	uint32_t m_x;
-	uint32_t m_y;
-	uint32_t m_width;
-	uint32_t m_height;
+	/*updated by the window thread, read by the render thread*/
+	std::atomic<uint32_t> m_x{0};
+	std::atomic<uint32_t> m_y{0};
+	std::atomic<uint32_t> m_width{0};
+	std::atomic<uint32_t> m_height{0};
+	std::atomic<bool> m_mapped{false};
+	std::atomic<bool> m_obscured{false};
 
 	WindowParameters m_params;
 };
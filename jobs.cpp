@@ -0,0 +1,368 @@
+#include "jobs.h"
+#include "debug.h"
+
+#include <iomanip>
+#include <algorithm>
+
+/*index of the pool worker running on this thread, -1 outside of any pool*/
+static thread_local int32_t t_worker_index = -1;
+static thread_local const JobSystem* t_owner = NULL;
+
+void JobSystem::init(uint32_t worker_count)
+{
+	if (m_running)
+		return;
+
+	if (worker_count == 0)
+	{
+		uint32_t hw = std::thread::hardware_concurrency();
+		worker_count = hw > 1 ? hw - 1 : 1;
+	}
+
+	m_start_time = std::chrono::steady_clock::now();
+	m_running = true;
+
+	for (uint32_t i = 0; i < worker_count; i++)
+		m_workers.push_back(std::make_unique<Worker>());
+
+	/*start the threads only once every deque exists, workers steal from each other right away*/
+	for (uint32_t i = 0; i < worker_count; i++)
+		m_workers[i]->thread = std::thread(&JobSystem::workerMain, this, i);
+}
+
+void JobSystem::destroy()
+{
+	if (!m_running)
+		return;
+
+	/*workers finish what is queued before they exit*/
+	{
+		std::lock_guard<std::mutex> lock(m_sleep_mutex);
+		m_running = false;
+	}
+	m_sleep_cv.notify_all();
+
+	for (auto& worker : m_workers)
+	{
+		if (worker->thread.joinable())
+			worker->thread.join();
+	}
+
+	m_workers.clear();
+}
+
+JobHandle JobSystem::schedule(std::function<void()> fn, const std::vector<JobHandle>& dependencies)
+{
+	JobHandle job = std::make_shared<JobNode>();
+	job->fn = std::move(fn);
+
+	/*without workers everything runs inline, dependencies have already run the same way*/
+	if (!m_running)
+	{
+		job->fn();
+		job->done = true;
+		return job;
+	}
+
+	for (auto& dep : dependencies)
+	{
+		if (!dep)
+			continue;
+
+		std::lock_guard<std::mutex> lock(dep->mutex);
+		if (!dep->done)
+		{
+			job->pending++;
+			dep->successors.push_back(job);
+		}
+	}
+
+	/*drop the scheduling reference, whoever brings pending to zero queues the job*/
+	if (job->pending.fetch_sub(1) == 1)
+		enqueue(job);
+
+	return job;
+}
+
+bool JobSystem::isDone(const JobHandle& job)
+{
+	return !job || job->done;
+}
+
+void JobSystem::wait(const JobHandle& job)
+{
+	int32_t index = t_owner == this ? t_worker_index : -1;
+
+	/*outside the pool (the render thread, startup) unrelated jobs never run here. The job itself runs here
+	if it is still queued once its dependencies finished, a worker already running it is waited for.*/
+	if (index < 0)
+	{
+		bool taken_elsewhere = false;
+
+		while (!isDone(job))
+		{
+			if (!taken_elsewhere && job->pending == 0)
+			{
+				if (takeJob(job))
+				{
+					execute(job, index, false);
+					break;
+				}
+				taken_elsewhere = true;
+			}
+
+			/*every finished job wakes this thread, among them the dependencies*/
+			std::unique_lock<std::mutex> lock(m_sleep_mutex);
+			m_done_cv.wait(lock, [&] { return job->done || (!taken_elsewhere && job->pending == 0); });
+		}
+		return;
+	}
+
+	while (!isDone(job))
+	{
+		bool stolen = false;
+		JobHandle next = take(index, stolen);
+		if (next)
+		{
+			execute(next, index, stolen);
+			continue;
+		}
+
+		/*the job runs on another thread, sleep until something finishes or gets queued*/
+		std::unique_lock<std::mutex> lock(m_sleep_mutex);
+		m_sleep_cv.wait(lock, [&] { return job->done || m_queued > 0; });
+	}
+}
+
+void JobSystem::parallelFor(uint32_t count, uint32_t grain, const std::function<void(uint32_t begin, uint32_t end)>& fn)
+{
+	if (count == 0)
+		return;
+
+	if (grain == 0)
+		grain = 1;
+
+	uint32_t ranges = (count + grain - 1) / grain;
+	if (ranges == 1 || !m_running)
+	{
+		fn(0, count);
+		return;
+	}
+
+	std::vector<JobHandle> jobs;
+	jobs.reserve(ranges - 1);
+
+	for (uint32_t r = 1; r < ranges; r++)
+	{
+		uint32_t begin = r * grain;
+		uint32_t end = std::min(begin + grain, count);
+		jobs.push_back(schedule([&fn, begin, end] { fn(begin, end); }));
+	}
+
+	/*the first range runs on the calling thread*/
+	fn(0, std::min(grain, count));
+
+	for (auto& job : jobs)
+		wait(job);
+}
+
+uint32_t JobSystem::getWorkerCount() const noexcept
+{
+	return m_workers.size();
+}
+
+std::vector<JobWorkerStats> JobSystem::getStatistics() const
+{
+	std::vector<JobWorkerStats> stats(m_workers.size());
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start_time).count();
+
+	for (size_t i = 0; i < m_workers.size(); i++)
+	{
+		stats[i].jobs = m_workers[i]->jobs;
+		stats[i].steals = m_workers[i]->steals;
+		stats[i].busy = m_workers[i]->busy_ns / 1e9;
+		stats[i].utilization = elapsed > 0.0 ? stats[i].busy / elapsed : 0.0;
+	}
+
+	return stats;
+}
+
+void JobSystem::printStatistics() const
+{
+	auto stats = getStatistics();
+
+	for (size_t i = 0; i < stats.size(); i++)
+	{
+		cout << "Job worker " << i << ": " << stats[i].jobs << " jobs, " << stats[i].steals << " stolen, "
+			<< std::fixed << std::setprecision(1) << stats[i].utilization * 100.0 << "% busy" << std::defaultfloat << '\n';
+	}
+}
+
+void JobSystem::workerMain(uint32_t index)
+{
+	t_worker_index = index;
+	t_owner = this;
+
+	while (true)
+	{
+		bool stolen = false;
+		JobHandle job = take(index, stolen);
+		if (job)
+		{
+			execute(job, index, stolen);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_sleep_mutex);
+		m_sleep_cv.wait(lock, [this] { return m_queued > 0 || !m_running; });
+
+		if (!m_running && m_queued == 0)
+			break;
+	}
+
+	t_worker_index = -1;
+	t_owner = NULL;
+}
+
+void JobSystem::enqueue(const JobHandle& job)
+{
+	/*counted before it is visible, take() never sees more jobs than m_queued*/
+	m_queued++;
+
+	/*workers keep what they spawn local, it is likely to touch the same data*/
+	if (t_owner == this && t_worker_index >= 0)
+	{
+		Worker& worker = *m_workers[t_worker_index];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		worker.queue.push_back(job);
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(m_shared_mutex);
+		m_shared.push_back(job);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_sleep_mutex);
+	}
+	m_sleep_cv.notify_one();
+}
+
+JobHandle JobSystem::take(int32_t worker_index, bool& stolen)
+{
+	JobHandle job;
+
+	if (m_queued == 0)
+		return job;
+
+	/*own work newest first, it is the most likely to still be in cache*/
+	if (worker_index >= 0)
+	{
+		Worker& worker = *m_workers[worker_index];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (!worker.queue.empty())
+		{
+			job = std::move(worker.queue.back());
+			worker.queue.pop_back();
+		}
+	}
+
+	if (!job)
+	{
+		std::lock_guard<std::mutex> lock(m_shared_mutex);
+		if (!m_shared.empty())
+		{
+			job = std::move(m_shared.front());
+			m_shared.pop_front();
+		}
+	}
+
+	/*steal the oldest job of another worker, starting with the next one to spread contention*/
+	for (size_t i = 1; !job && i <= m_workers.size(); i++)
+	{
+		size_t victim = (worker_index + i) % m_workers.size();
+		if ((int32_t)victim == worker_index)
+			continue;
+
+		Worker& worker = *m_workers[victim];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (!worker.queue.empty())
+		{
+			job = std::move(worker.queue.front());
+			worker.queue.pop_front();
+			stolen = true;
+		}
+	}
+
+	if (job)
+		m_queued--;
+
+	return job;
+}
+
+bool JobSystem::takeJob(const JobHandle& job)
+{
+	auto remove = [this, &job](std::deque<JobHandle>& queue)
+	{
+		auto it = std::find(queue.begin(), queue.end(), job);
+		if (it == queue.end())
+			return false;
+
+		queue.erase(it);
+		m_queued--;
+		return true;
+	};
+
+	{
+		std::lock_guard<std::mutex> lock(m_shared_mutex);
+		if (remove(m_shared))
+			return true;
+	}
+
+	for (auto& worker : m_workers)
+	{
+		std::lock_guard<std::mutex> lock(worker->mutex);
+		if (remove(worker->queue))
+			return true;
+	}
+
+	return false;
+}
+
+void JobSystem::execute(const JobHandle& job, int32_t worker_index, bool stolen)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	job->fn();
+	job->fn = nullptr;
+
+	if (worker_index >= 0)
+	{
+		Worker& worker = *m_workers[worker_index];
+		worker.jobs++;
+		if (stolen)
+			worker.steals++;
+		worker.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	std::vector<JobHandle> successors;
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->done = true;
+		successors.swap(job->successors);
+	}
+
+	for (auto& successor : successors)
+	{
+		if (successor->pending.fetch_sub(1) == 1)
+			enqueue(successor);
+	}
+
+	/*wake everyone waiting for this job*/
+	{
+		std::lock_guard<std::mutex> lock(m_sleep_mutex);
+	}
+	m_sleep_cv.notify_all();
+	m_done_cv.notify_all();
+}
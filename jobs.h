@@ -0,0 +1,105 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/*A scheduled job, runs once every job it depends on has finished*/
+struct JobNode
+{
+	std::function<void()> fn;
+
+	/*jobs still to finish before this one may run, plus one while it is being scheduled*/
+	std::atomic<uint32_t> pending{1};
+	std::atomic<bool> done{false};
+
+	/*guards successors and the done transition*/
+	std::mutex mutex;
+	std::vector<std::shared_ptr<JobNode>> successors;
+};
+
+using JobHandle = std::shared_ptr<JobNode>;
+
+struct JobWorkerStats
+{
+	uint64_t jobs = 0;
+	uint64_t steals = 0;
+	/*seconds spent running jobs*/
+	double busy = 0.0;
+	/*busy time over the time since init*/
+	double utilization = 0.0;
+};
+
+/*Work-stealing thread pool. Every worker owns a deque, it pops its own work from the back while idle
+workers steal from the front. Threads outside the pool push to a shared queue. A worker's wait() runs
+queued jobs instead of blocking, so waiting from a job never leaves a core idle. Threads outside the pool,
+like the render thread, only ever run the job they wait for, and otherwise sleep until it finished.*/
+class JobSystem
+{
+public:
+	JobSystem() = default;
+	~JobSystem() = default;
+
+	/*0 uses one worker per hardware thread but the calling one*/
+	void init(uint32_t worker_count = 0);
+	void destroy();
+
+	/*Runs fn once every job in dependencies finished, empty handles are ignored*/
+	JobHandle schedule(std::function<void()> fn, const std::vector<JobHandle>& dependencies = {});
+	/*On a worker runs queued jobs until job finished, elsewhere runs job itself if it is still queued
+	and sleeps otherwise. An empty handle returns right away.*/
+	void wait(const JobHandle& job);
+	static bool isDone(const JobHandle& job);
+
+	/*Splits [0, count) into ranges of at most grain items and returns once all of them ran*/
+	void parallelFor(uint32_t count, uint32_t grain, const std::function<void(uint32_t begin, uint32_t end)>& fn);
+
+	uint32_t getWorkerCount() const noexcept;
+	std::vector<JobWorkerStats> getStatistics() const;
+	void printStatistics() const;
+
+private:
+	struct Worker
+	{
+		std::thread thread;
+		std::mutex mutex;
+		std::deque<JobHandle> queue;
+
+		std::atomic<uint64_t> jobs{0};
+		std::atomic<uint64_t> steals{0};
+		std::atomic<uint64_t> busy_ns{0};
+	};
+
+	void workerMain(uint32_t index);
+	void enqueue(const JobHandle& job);
+	JobHandle take(int32_t worker_index, bool& stolen);
+	/*removes job from whichever queue holds it, false if it is not queued (yet or any more)*/
+	bool takeJob(const JobHandle& job);
+	void execute(const JobHandle& job, int32_t worker_index, bool stolen);
+
+	std::vector<std::unique_ptr<Worker>> m_workers;
+
+	/*jobs scheduled from threads outside the pool*/
+	std::mutex m_shared_mutex;
+	std::deque<JobHandle> m_shared;
+
+	/*idle workers and waiters sleep here until a job is queued or finished*/
+	std::mutex m_sleep_mutex;
+	std::condition_variable m_sleep_cv;
+	/*threads outside the pool only wake when a job finished, so they never take a wakeup meant for a worker*/
+	std::condition_variable m_done_cv;
+	std::atomic<uint32_t> m_queued{0};
+	std::atomic<bool> m_running{false};
+
+	std::chrono::steady_clock::time_point m_start_time;
+};
+
+#endif //JOBS_H
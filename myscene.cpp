@@ -2,22 +2,16 @@
 #include "shader.h"
 #include <iostream>
 #include <cstdlib>
-#include <future>
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
 
 #include <Magick++.h>
 using namespace Magick;
 
-enum SemNames{s_acquire_image, s_submit, num_sems};
-//enum FenNames{f_submit, num_fences};
-
 constexpr const auto img_filename = "bridge.jpg";
 
-constexpr const float x_bound = 5000.0f;
-constexpr const float y_bound = 5000.0f;
-constexpr const float z_bound = 5000.0f;
-constexpr const float min_speed = 50.0f;
-constexpr const float mid_speed = 100.0f;
-constexpr const float top_speed = 200.0f;
+constexpr const VkFormat target_image_format = VK_FORMAT_R8G8B8A8_UINT;
 
 constexpr const uint32_t video_res_x = 1920;
 constexpr const uint32_t video_res_y = 1080;
@@ -27,18 +21,16 @@ bool recording = false;
 
 bool snap = false;
 
-struct s_constants
-{
-	glm::mat4x4 vp;
-	float dt;
-	float particle_speed = min_speed;
-	uint32_t res_x = 960;
-	uint32_t res_y = 955;
-	glm::vec3 eyeW;
-	float p0;
-	glm::vec3 curDirNW;
-	float p1;
-} constants;
+s_constants constants;
+
+/*lossless by default, the quantized format is opt-in, see ParticleFormat*/
+ParticleFormat particle_format = ParticleFormat::AoS;
+
+uint32_t particle_seed = 1;
+bool seed_on_host = false;
+
+/*0 is one particle per pixel of the image*/
+uint32_t particle_count = 0;
 
 void loadImage(std::string pathname, uint16_t size_x, uint16_t size_y, void** dst)
 {
@@ -61,53 +53,63 @@ void loadImage(std::string pathname, uint16_t size_x, uint16_t size_y, void** ds
 	auto h = img.rows();
 	
 	PixelPacket* pixels = img.getPixels(0,0,w,h);
-	for(size_t p = 0; p < w*h; p++)
-	{
-		Color c = pixels[p];
-		
-		float r = c.redQuantum();
-		float g = c.greenQuantum();
-		float b = c.blueQuantum();
-		float a = c.alphaQuantum();
-		
-		constexpr const float _2_16 = 1 << 16;
-		constexpr const float max_col = sizeof(void*) == 8 ? _2_16 : 255;
-		
-		if(r != 0) r /= max_col;
-		if(g != 0) g /= max_col;
-		if(b != 0) b /= max_col;
-		if(a != 0) a /= max_col;
-		
-		buf[4*p] = r;
-		buf[4*p+1] = g;
-		buf[4*p+2] = b;
-		buf[4*p+3] = a;
-	}
-}
-
-int32_t findMemoryTypeIndex(uint32_t memory_type_bits, VkMemoryPropertyFlagBits required = (VkMemoryPropertyFlagBits)0, VkMemoryPropertyFlagBits wanted = (VkMemoryPropertyFlagBits)0)
-{
-	const VkPhysicalDeviceMemoryProperties& props = VulkanEngine::get().getPhyDevMemProps();
-	int32_t res = -1;
 	
-	for(size_t i = 0; i < props.memoryTypeCount; i++)
+	/*rows are converted in parallel, the pixel cache is only read*/
+	VulkanEngine::get().getJobs().parallelFor(h, 64, [&](uint32_t begin, uint32_t end)
 	{
-		if((memory_type_bits & (1 << i)) && (props.memoryTypes[i].propertyFlags & required) == required)
+		for(size_t p = begin*w; p < end*w; p++)
 		{
-			if(wanted != 0)
-			{
-				int match = props.memoryTypes[i].propertyFlags & wanted;
-				if(match == wanted)
-					return i;
-				else if(match != 0)
-					res = i;
-			}
-			else
-				return i;
+			Color c = pixels[p];
+			
+			float r = c.redQuantum();
+			float g = c.greenQuantum();
+			float b = c.blueQuantum();
+			float a = c.alphaQuantum();
+			
+			constexpr const float _2_16 = 1 << 16;
+			constexpr const float max_col = sizeof(void*) == 8 ? _2_16 : 255;
+			
+			if(r != 0) r /= max_col;
+			if(g != 0) g /= max_col;
+			if(b != 0) b /= max_col;
+			if(a != 0) a /= max_col;
+			
+			buf[4*p] = r;
+			buf[4*p+1] = g;
+			buf[4*p+2] = b;
+			buf[4*p+3] = a;
 		}
-	}
+	});
+}
+
+VkPhysicalDeviceFeatures MyScene::getRequiredFeatures()
+{
+	VkPhysicalDeviceFeatures features{};
+	features.samplerAnisotropy = VK_TRUE;
+	features.sampleRateShading = VK_TRUE;
 	
-	return res;
+	return features;
+}
+
+void MyScene::setParticleFormat(ParticleFormat format)
+{
+	particle_format = format;
+}
+
+ParticleFormat MyScene::getParticleFormat()
+{
+	return particle_format;
+}
+
+void MyScene::setParticleSeed(uint32_t seed, bool on_host)
+{
+	particle_seed = seed;
+	seed_on_host = on_host;
+}
+
+void MyScene::setParticleCount(uint32_t count)
+{
+	particle_count = count;
 }
 
 MyScene::MyScene()
@@ -122,72 +124,156 @@ MyScene::~MyScene()
 
 void MyScene::initialize()
 {
-	vkGetDeviceQueue(VulkanEngine::get().getDevice(), VulkanEngine::get().getQueueFamilyIndexGeneral(), 0, &m_queue);
+	JobSystem& jobs = VulkanEngine::get().getJobs();
+	StageTimes& times = VulkanEngine::startupTimes();
+	
+	m_queue = VulkanEngine::get().getQueueGeneral();
+	m_recorder.setJobSystem(&jobs);
 	
 	initSynchronizationObjects();
 	initCommandBuffers();
-	initImage();
-	initVertexBuffer();
-	initSampler();
-	initRecordImages();
-	initDescriptorSets();
 	
-	initSurfaceDependentObjects();
+	/*one particle per pixel of the image unless a count was given, the particle buffers and the seeding pipeline both need them*/
+	m_particle_count = particle_count != 0 ? particle_count : constants.res_x * constants.res_y;
+	
+	/*two positions, the target, the state and four list entries per particle, all device local*/
+	const VkDeviceSize particle_bytes = particle_buffer_count * ParticleSize(particle_format) + (2 + 2 * particle_buffer_count) * sizeof(uint32_t);
+	
+	VkPhysicalDeviceMemoryProperties mem_props;
+	vkGetPhysicalDeviceMemoryProperties(VulkanEngine::get().getPhysicalDevice(), &mem_props);
+	
+	VkDeviceSize device_heap = 0;
+	for(uint32_t h = 0; h < mem_props.memoryHeapCount; h++)
+	{
+		if(mem_props.memoryHeaps[h].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+			device_heap = std::max(device_heap, mem_props.memoryHeaps[h].size);
+	}
+	
+	/*the rest of the heap holds the image and the render targets, particles get at most half of it*/
+	const VkDeviceSize max_particles = device_heap / 2 / particle_bytes;
+	if(m_particle_count > max_particles)
+	{
+		std::cout << "Error: " << m_particle_count << " particles need " << ((m_particle_count * particle_bytes) >> 20) << " MiB, more than half the "
+			<< (device_heap >> 20) << " MiB device heap, using " << max_particles << '\n';
+		m_particle_count = (uint32_t)max_particles;
+	}
+	
+	m_particle_grid = ParticleGrid(m_particle_count, constants.res_x, constants.res_y);
+	
+	/*Startup as a dependency graph, the pipeline compiles while the image decodes and the particles are seeded.
+	Each stage is timed, VulkanEngine reports them along with the time to the first frame.*/
+	auto stage = [&jobs, &times](const char* name, std::function<void()> fn, const std::vector<JobHandle>& dependencies = {})
+	{
+		return jobs.schedule([&times, name, fn] { times.measure(name, fn); }, dependencies);
+	};
+	
+	JobHandle image = stage("Scene: image", [this] { initImage(); });
+	JobHandle particles = stage("Scene: particles", [this] { initParticleBuffers(); });
+	JobHandle record_images = stage("Scene: record images", [this] { initRecordImages(); });
+	JobHandle sampler = stage("Scene: sampler", [this] { initSampler(); });
+	/*the sampler is immutable, part of the layout*/
+	JobHandle layout = stage("Scene: descriptor set layout", [this] { initDescriptorSetLayout(); }, {sampler});
+	JobHandle pipeline = stage("Scene: render pass and pipeline", [this] { initRenderPass(); initGraphicsPipeline(); }, {layout});
+	JobHandle compute = stage("Scene: compute pipeline", [this] { initComputePipeline(); }, {layout});
+	JobHandle descriptors = stage("Scene: descriptor sets", [this] { initDescriptorSets(); }, {image, particles, layout});
+	/*finds the render pass in place and only creates the render targets*/
+	JobHandle surface = stage("Scene: render targets", [this] { initSurfaceDependentObjects(); }, {pipeline});
+	
+	/*every other stage is a dependency of one of these*/
+	jobs.wait(record_images);
+	jobs.wait(descriptors);
+	jobs.wait(surface);
+	jobs.wait(compute);
 }
 
 void MyScene::initSurfaceDependentObjects()
 {
 	float ratio = (float)VulkanEngine::get().getSurfaceExtent().width / (float)VulkanEngine::get().getSurfaceExtent().height;
-	m_camera = std::make_unique<Camera>(ratio, 1.0f, 1000.0f, M_PI_2);
+	
+	/*keep the camera where it is on resize, only the projection changes*/
+	if(!m_camera)
+		m_camera = std::make_unique<Camera>(ratio, 1.0f, 1000.0f, M_PI_2);
+	else
+		m_camera->setAspectRatio(ratio);
+	
+	/*viewport and scissor are dynamic, so the pipeline only has to be (re)built along with the render pass*/
+	if(m_render_pass == VK_NULL_HANDLE)
+	{
+		initRenderPass();
+		initGraphicsPipeline();
+	}
 	
 	initRenderTargets();
-	initGraphicsPipeline();
+	
+	/*no frame uses any of the (new) swapchain images yet*/
+	m_image_fences.assign(VulkanEngine::get().getSwapchainImages().size(), VK_NULL_HANDLE);
+}
+
+void MyScene::destroyRenderTargets()
+{
+	/*frames in flight may still render into them, they go once those frames completed*/
+	VulkanEngine::get().destroyLater([render_targets = std::move(m_render_targets)]() mutable
+	{
+		for(auto& rt : render_targets)
+		{
+			rt.destroy();
+		}
+	});
+	m_render_targets.clear();
 }
 
 void MyScene::destroySurfaceDependentObjects()
 {
 	VkDevice d = VulkanEngine::get().getDevice();
 	
-	if(m_pipeline_layout != VK_NULL_HANDLE)
-	{
-		vkDestroyPipelineLayout(d, m_pipeline_layout, VK_NULL_HANDLE);
-		m_pipeline_layout = VK_NULL_HANDLE;
-	}
-	
-	if (m_graphics_pipeline != VK_NULL_HANDLE)
-	{
-		vkDestroyPipeline(d, m_graphics_pipeline, VK_NULL_HANDLE);
-		m_graphics_pipeline = VK_NULL_HANDLE;
-	}
+	destroyRenderTargets();
 	
-	for(auto& rt : m_render_targets)
+	VulkanEngine::get().destroyLater([d, pipeline_layout = m_pipeline_layout, pipeline = m_graphics_pipeline, render_pass = m_render_pass]
 	{
-		rt.destroy();
-	}
+		if(pipeline_layout != VK_NULL_HANDLE)
+			vkDestroyPipelineLayout(d, pipeline_layout, VK_NULL_HANDLE);
+		
+		if(pipeline != VK_NULL_HANDLE)
+			vkDestroyPipeline(d, pipeline, VK_NULL_HANDLE);
+		
+		if(render_pass != VK_NULL_HANDLE)
+			vkDestroyRenderPass(d, render_pass, VK_NULL_HANDLE);
+	});
 	
-	if (m_render_pass != VK_NULL_HANDLE)
-	{
-		vkDestroyRenderPass(d, m_render_pass, VK_NULL_HANDLE);
-		m_render_pass = VK_NULL_HANDLE;
-	}
+	m_pipeline_layout = VK_NULL_HANDLE;
+	m_graphics_pipeline = VK_NULL_HANDLE;
+	m_render_pass = VK_NULL_HANDLE;
 }
 
 void MyScene::initSynchronizationObjects()
 {
-	//fences---------------
+	VkDevice d = VulkanEngine::get().getDevice();
+	
+	/*one set of synchronization objects per frame in flight*/
+	m_frames.resize(std::max(1u, VulkanEngine::settings().frames_in_flight));
+	
 	VkFenceCreateInfo fence_create_info{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, NULL, VK_FENCE_CREATE_SIGNALED_BIT};
-	m_fences.resize(VulkanEngine::get().getSwapchainImages().size());
-	for(auto& f : m_fences)
+	VkSemaphoreCreateInfo sem_create_info{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, NULL, 0};
+	
+	for(auto& f : m_frames)
 	{
-		vkCreateFence(VulkanEngine::get().getDevice(), &fence_create_info, VK_NULL_HANDLE, &f);
+		vkCreateFence(d, &fence_create_info, VK_NULL_HANDLE, &f.fence);
+		vkCreateSemaphore(d, &sem_create_info, VK_NULL_HANDLE, &f.sem_acquire);
+		vkCreateSemaphore(d, &sem_create_info, VK_NULL_HANDLE, &f.sem_submit);
+		vkCreateSemaphore(d, &sem_create_info, VK_NULL_HANDLE, &f.sem_readback);
 	}
 	
-	//semaphores-----------
-	VkSemaphoreCreateInfo sem_create_info{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, NULL, 0};
-	m_semaphores.resize(num_sems);
-	for(auto& s : m_semaphores)
+	/*the simulation is timed on the GPU when graphics and compute queues support timestamps*/
+	if(VulkanEngine::get().getPhyDevProps().limits.timestampComputeAndGraphics)
 	{
-		vkCreateSemaphore(VulkanEngine::get().getDevice(), &sem_create_info, VK_NULL_HANDLE, &s);
+		VkQueryPoolCreateInfo query_pool_create_info{};
+		query_pool_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		query_pool_create_info.pNext = NULL;
+		query_pool_create_info.flags = 0;
+		query_pool_create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		query_pool_create_info.queryCount = 2 * m_frames.size();
+		
+		vkCreateQueryPool(d, &query_pool_create_info, VK_NULL_HANDLE, &m_sim_queries);
 	}
 }
 
@@ -195,19 +281,37 @@ void MyScene::destroySynchronizationObjects()
 {
 	VkDevice d = VulkanEngine::get().getDevice();
 	
-	for(auto& f : m_fences)
+	for(auto& f : m_frames)
 	{
-		vkDestroyFence(d, f, VK_NULL_HANDLE);
-		f = VK_NULL_HANDLE;
+		if(f.fence != VK_NULL_HANDLE)
+		{
+			vkDestroyFence(d, f.fence, VK_NULL_HANDLE);
+			f.fence = VK_NULL_HANDLE;
+		}
+		
+		if(f.sem_acquire != VK_NULL_HANDLE)
+		{
+			vkDestroySemaphore(d, f.sem_acquire, VK_NULL_HANDLE);
+			f.sem_acquire = VK_NULL_HANDLE;
+		}
+		
+		if(f.sem_submit != VK_NULL_HANDLE)
+		{
+			vkDestroySemaphore(d, f.sem_submit, VK_NULL_HANDLE);
+			f.sem_submit = VK_NULL_HANDLE;
+		}
+		
+		if(f.sem_readback != VK_NULL_HANDLE)
+		{
+			vkDestroySemaphore(d, f.sem_readback, VK_NULL_HANDLE);
+			f.sem_readback = VK_NULL_HANDLE;
+		}
 	}
 	
-	for(auto& s : m_semaphores)
+	if(m_sim_queries != VK_NULL_HANDLE)
 	{
-		if (s != VK_NULL_HANDLE)
-		{
-			vkDestroySemaphore(d, s, VK_NULL_HANDLE);
-			s = VK_NULL_HANDLE;
-		}
+		vkDestroyQueryPool(d, m_sim_queries, VK_NULL_HANDLE);
+		m_sim_queries = VK_NULL_HANDLE;
 	}
 }
 
@@ -221,17 +325,22 @@ void MyScene::initCommandBuffers()
 	
 	vkCreateCommandPool(VulkanEngine::get().getDevice(), &command_pool_create_info, VK_NULL_HANDLE, &m_command_pool);
 	
-	/*create a command buffer for each swapchain image*/
-	m_command_buffers.resize(VulkanEngine::get().getSwapchainImages().size());
+	/*create a command buffer for each frame in flight*/
+	std::vector<VkCommandBuffer> command_buffers(m_frames.size());
 	
 	VkCommandBufferAllocateInfo command_buffer_allocate_info{};
 	command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	command_buffer_allocate_info.pNext = NULL;
 	command_buffer_allocate_info.commandPool = m_command_pool;
-	command_buffer_allocate_info.commandBufferCount = m_command_buffers.size();
+	command_buffer_allocate_info.commandBufferCount = command_buffers.size();
 	command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 	
-	vkAllocateCommandBuffers(VulkanEngine::get().getDevice(), &command_buffer_allocate_info, m_command_buffers.data());
+	vkAllocateCommandBuffers(VulkanEngine::get().getDevice(), &command_buffer_allocate_info, command_buffers.data());
+	
+	for(size_t i = 0; i < m_frames.size(); i++)
+	{
+		m_frames[i].cmd_buf = command_buffers[i];
+	}
 }
 
 void MyScene::initRecordImages()
@@ -273,35 +382,19 @@ void MyScene::initRecordImages()
 	ti_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	
 	
-	VkMemoryRequirements req{};
-	VkMemoryAllocateInfo alloc_info{};
-	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc_info.pNext = NULL;
+	VulkanAllocator& allocator = e.getAllocator();
 	
 	for(auto& ri : m_record_images)
 	{
 		/*img*/
 		vkCreateImage(e.getDevice(), &ri_create_info, VK_NULL_HANDLE, &ri.img);
 		
-		vkGetImageMemoryRequirements(e.getDevice(), ri.img, &req);
-		
-		alloc_info.allocationSize = req.size;
-		alloc_info.memoryTypeIndex = findMemoryTypeIndex(req.memoryTypeBits);
-		
-		vkAllocateMemory(e.getDevice(), &alloc_info, VK_NULL_HANDLE, &ri.img_mem);
-		
-		vkBindImageMemory(e.getDevice(), ri.img, ri.img_mem, 0);
+		allocator.allocateImage(ri.img, ri_create_info.tiling, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryTag::Recording, ri.img_mem);
 		
-		/*img1*/
+		/*img1, cached memory makes the host reads of the recorder fast*/
 		vkCreateImage(e.getDevice(), &ti_create_info, VK_NULL_HANDLE, &ri.img1);
 		
-		vkGetImageMemoryRequirements(e.getDevice(), ri.img1, &req);
-		alloc_info.allocationSize = req.size;
-		alloc_info.memoryTypeIndex = findMemoryTypeIndex(req.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
-		
-		vkAllocateMemory(e.getDevice(), &alloc_info, VK_NULL_HANDLE, &ri.img_mem1);
-		
-		vkBindImageMemory(e.getDevice(), ri.img1, ri.img_mem1, 0);
+		allocator.allocateImage(ri.img1, ti_create_info.tiling, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT, MemoryTag::Recording, ri.img_mem1);
 	}
 	
 	
@@ -342,33 +435,48 @@ void MyScene::initImage()
 	image_create_info.mipLevels = 1;
 	image_create_info.arrayLayers = 1;
 	image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
-	image_create_info.tiling = VK_IMAGE_TILING_LINEAR;
-	image_create_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+	image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_create_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 	image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	image_create_info.initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED;
+	image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	
 	vkCreateImage(d, &image_create_info, VK_NULL_HANDLE, &m_image);
 	
-	VkMemoryRequirements mem_req;
-	vkGetImageMemoryRequirements(d, m_image, &mem_req);
+	/*lives as long as the scene, nothing to gain from buddy ranges*/
+	VulkanEngine::get().getAllocator().allocateImage(m_image, image_create_info.tiling, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, MemoryTag::Textures, m_image_memory, AllocationStrategy::Linear);
 	
-	VkMemoryAllocateInfo mem_alloc_info{};
-	mem_alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	mem_alloc_info.pNext = NULL;
-	mem_alloc_info.allocationSize = mem_req.size;
-	mem_alloc_info.memoryTypeIndex = findMemoryTypeIndex(mem_req.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+	/*Load image into a staging buffer and upload it on the transfer queue, the graphics queue
+	takes the image over before the first frame without the host waiting for the copy*/
 	
-	vkAllocateMemory(d, &mem_alloc_info, VK_NULL_HANDLE, &m_image_memory);
-	vkBindImageMemory(d, m_image, m_image_memory, 0);
-	
-	/*Load image*/
+	VulkanTransfer& transfer = VulkanEngine::get().getTransfer();
+	DeviceDispatch& vk = VulkanEngine::get().getDispatch();
+	TransferBatch* batch = transfer.begin();
 	
 	void* ptr;
-	vkMapMemory(d, m_image_memory, 0, VK_WHOLE_SIZE, 0, &ptr);
+	VkBuffer staging = transfer.createStagingBuffer(batch, 4 * sizeof(float) * constants.res_x * constants.res_y, &ptr);
 	
 	loadImage(img_filename, constants.res_x, constants.res_y, &ptr);
 	
-	vkUnmapMemory(d, m_image_memory);
+	VkImageMemoryBarrier to_trans_d{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, NULL, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+	VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, m_image,
+	{VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}};
+	
+	vk.vkCmdPipelineBarrier(batch->cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &to_trans_d);
+	
+	VkBufferImageCopy region{};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+	region.imageOffset = {0, 0, 0};
+	region.imageExtent = image_create_info.extent;
+	
+	vk.vkCmdCopyBufferToImage(batch->cmd_buf, staging, m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	
+	transfer.releaseToGraphics(batch, m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	
+	transfer.submit(batch);
 	
 	/*Create image view*/
 	
@@ -401,11 +509,76 @@ void MyScene::destroyImage()
 		m_image = VK_NULL_HANDLE;
 	}
 	
-	if(m_image_memory != VK_NULL_HANDLE)
+	VulkanEngine::get().getAllocator().free(m_image_memory);
+}
+
+void MyScene::initRenderPass()
+{
+	/*The render pass only depends on attachment formats, so it is kept across resizes
+	as long as the surface format does not change*/
+	m_render_pass_format = VulkanEngine::get().getSurfaceFormat();
+	
+	VkAttachmentDescription at_desc[3]{};
+	
+	/*color attachment - target image*/
+	at_desc[0].flags = 0;
+	at_desc[0].format = target_image_format;
+	at_desc[0].samples = VK_SAMPLE_COUNT_1_BIT;
+	at_desc[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	at_desc[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	at_desc[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	at_desc[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	
+	/*color attachment - swapchain image*/
+	at_desc[1].flags = 0;
+	at_desc[1].format = VulkanEngine::get().getSurfaceFormat();
+	at_desc[1].samples = VK_SAMPLE_COUNT_1_BIT;
+	at_desc[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	at_desc[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	at_desc[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	at_desc[1].finalLayout = VulkanEngine::get().getPresentLayout();
+	
+	/*depth stencil attachment - depth stencil buffer*/
+	at_desc[2].flags = 0;
+	at_desc[2].format = VK_FORMAT_D32_SFLOAT;
+	at_desc[2].samples = VK_SAMPLE_COUNT_1_BIT;
+	at_desc[2].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	at_desc[2].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	at_desc[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	at_desc[2].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	
+	std::vector<VkAttachmentReference> col_at_ref =
 	{
-		vkFreeMemory(d, m_image_memory, VK_NULL_HANDLE);
-		m_image_memory = VK_NULL_HANDLE;
-	}
+		{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
+		{1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}
+	};
+	
+	VkAttachmentReference ds_at_ref{2, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+	
+	VkSubpassDescription sub_desc{};
+	sub_desc.flags = 0;
+	sub_desc.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	sub_desc.inputAttachmentCount = 0;
+	sub_desc.pInputAttachments = NULL;
+	sub_desc.colorAttachmentCount = col_at_ref.size();
+	sub_desc.pColorAttachments = col_at_ref.data();
+	sub_desc.pResolveAttachments = NULL;
+	sub_desc.pDepthStencilAttachment = &ds_at_ref;
+	sub_desc.preserveAttachmentCount = 0;
+	sub_desc.pPreserveAttachments = NULL;
+	
+	VkRenderPassCreateInfo render_pass_create_info{};
+	render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	render_pass_create_info.pNext = NULL;
+	render_pass_create_info.flags = 0;
+	render_pass_create_info.attachmentCount = 3;
+	render_pass_create_info.pAttachments = at_desc;
+	render_pass_create_info.subpassCount = 1;
+	render_pass_create_info.pSubpasses = &sub_desc;
+	render_pass_create_info.dependencyCount = 0;
+	render_pass_create_info.pDependencies = NULL;
+	
+	vkCreateRenderPass(VulkanEngine::get().getDevice(), &render_pass_create_info, VK_NULL_HANDLE, &m_render_pass);
 }
 
 void MyScene::initRenderTargets()
@@ -423,7 +596,7 @@ void MyScene::initRenderTargets()
 	image_create_info.pNext = NULL;
 	image_create_info.flags = 0;
 	image_create_info.imageType = VK_IMAGE_TYPE_2D;
-	image_create_info.format = VK_FORMAT_R8G8B8A8_UINT;//VulkanEngine::get().getSurfaceFormat();
+	image_create_info.format = target_image_format;//VulkanEngine::get().getSurfaceFormat();
 	image_create_info.extent = VkExtent3D{VulkanEngine::get().getSurfaceExtent().width, VulkanEngine::get().getSurfaceExtent().height, 1};
 	image_create_info.mipLevels = 1;
 	image_create_info.arrayLayers = 1;
@@ -443,24 +616,15 @@ void MyScene::initRenderTargets()
 	iv_create_info.components = {VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY};
 	iv_create_info.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1};
 	
-	VkMemoryAllocateInfo mem_alloc_info{};
-	mem_alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	mem_alloc_info.pNext = NULL;
-	
-	VkMemoryRequirements mem_req;
+	/*render targets are recreated on every resize, buddy ranges are reused without new device allocations*/
+	VulkanAllocator& allocator = VulkanEngine::get().getAllocator();
 	
 	/*Create image for each render target*/
 	for(auto& rt : m_render_targets)
 	{
 		vkCreateImage(d, &image_create_info, VK_NULL_HANDLE, &rt.target_image.img);
 		
-		vkGetImageMemoryRequirements(d, rt.target_image.img, &mem_req);
-		
-		mem_alloc_info.allocationSize = mem_req.size;
-		mem_alloc_info.memoryTypeIndex = findMemoryTypeIndex(mem_req.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		
-		vkAllocateMemory(d, &mem_alloc_info, VK_NULL_HANDLE, &rt.target_image.mem);
-		vkBindImageMemory(d, rt.target_image.img, rt.target_image.mem, 0);
+		allocator.allocateImage(rt.target_image.img, image_create_info.tiling, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, MemoryTag::RenderTargets, rt.target_image.mem);
 		
 		iv_create_info.image = rt.target_image.img;
 		vkCreateImageView(d, &iv_create_info, VK_NULL_HANDLE, &rt.target_image.img_view);
@@ -500,16 +664,8 @@ void MyScene::initRenderTargets()
 		/*Create image*/
 		vkCreateImage(d, &ds_img_create_info, VK_NULL_HANDLE, &rt.depth_stencil_buffer.img);
 		
-		/*Get given image memory requirements*/
-		vkGetImageMemoryRequirements(d, rt.depth_stencil_buffer.img, &mem_req);
-		
-		/*Update memory allocation info based on acquired requirements*/
-		mem_alloc_info.allocationSize = mem_req.size;
-		mem_alloc_info.memoryTypeIndex = findMemoryTypeIndex(mem_req.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		
 		/*Allocate and bind memory to given image*/
-		vkAllocateMemory(d, &mem_alloc_info, VK_NULL_HANDLE, &rt.depth_stencil_buffer.mem);
-		vkBindImageMemory(d, rt.depth_stencil_buffer.img, rt.depth_stencil_buffer.mem, 0);
+		allocator.allocateImage(rt.depth_stencil_buffer.img, ds_img_create_info.tiling, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, MemoryTag::RenderTargets, rt.depth_stencil_buffer.mem);
 		
 		/*Create image view for given image*/
 		ds_img_view_create_info.image = rt.depth_stencil_buffer.img;
@@ -517,70 +673,6 @@ void MyScene::initRenderTargets()
 	}
 	
 	
-	/*---Creating render pass---*/
-	
-	VkAttachmentDescription at_desc[3]{};
-	
-	/*color attachment - target image*/
-	at_desc[0].flags = 0;
-	at_desc[0].format = image_create_info.format; //use image create info defined earlier in this function
-	at_desc[0].samples = VK_SAMPLE_COUNT_1_BIT;
-	at_desc[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	at_desc[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	at_desc[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	at_desc[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-	
-	/*color attachment - swapchain image*/
-	at_desc[1].flags = 0;
-	at_desc[1].format = VulkanEngine::get().getSurfaceFormat();
-	at_desc[1].samples = VK_SAMPLE_COUNT_1_BIT;
-	at_desc[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	at_desc[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	at_desc[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	at_desc[1].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-	
-	/*depth stencil attachment - depth stencil buffer*/
-	at_desc[2].flags = 0;
-	at_desc[2].format = VK_FORMAT_D32_SFLOAT;
-	at_desc[2].samples = VK_SAMPLE_COUNT_1_BIT;
-	at_desc[2].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	at_desc[2].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	at_desc[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	at_desc[2].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
-	
-	std::vector<VkAttachmentReference> col_at_ref =
-	{
-		{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
-		{1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}
-	};
-	
-	VkAttachmentReference ds_at_ref{2, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
-	
-	VkSubpassDescription sub_desc{};
-	sub_desc.flags = 0;
-	sub_desc.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	sub_desc.inputAttachmentCount = 0;
-	sub_desc.pInputAttachments = NULL;
-	sub_desc.colorAttachmentCount = col_at_ref.size();
-	sub_desc.pColorAttachments = col_at_ref.data();
-	sub_desc.pResolveAttachments = NULL;
-	sub_desc.pDepthStencilAttachment = &ds_at_ref;
-	sub_desc.preserveAttachmentCount = 0;
-	sub_desc.pPreserveAttachments = NULL;
-	
-	VkRenderPassCreateInfo render_pass_create_info{};
-	render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	render_pass_create_info.pNext = NULL;
-	render_pass_create_info.flags = 0;
-	render_pass_create_info.attachmentCount = 3;
-	render_pass_create_info.pAttachments = at_desc;
-	render_pass_create_info.subpassCount = 1;
-	render_pass_create_info.pSubpasses = &sub_desc;
-	render_pass_create_info.dependencyCount = 0;
-	render_pass_create_info.pDependencies = NULL;
-	
-	vkCreateRenderPass(VulkanEngine::get().getDevice(), &render_pass_create_info, VK_NULL_HANDLE, &m_render_pass);
-	
 	/*---Creating framebuffers---*/
 	/*Create a set of identical framebuffers, one for each swapchain image*/
 	
@@ -635,85 +727,207 @@ void MyScene::initRenderTargets()
 	}
 }
 
-void MyScene::initVertexBuffer()
+void MyScene::initParticleBuffers()
 {
 	VulkanEngine& e = VulkanEngine::get();
-	
-	/*---Creating buffer---*/
-	
-	/*Specify usage as storage texel buffer to store formatted vertex data,
-	that can be read and written inside shaders*/
-	VkBufferCreateInfo vb_create_info{};
-	vb_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	vb_create_info.pNext = NULL;
-	vb_create_info.flags = 0;
-	vb_create_info.size = sizeof(Vertex) * constants.res_x * constants.res_y;
-	vb_create_info.usage = VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT;
-	vb_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	vb_create_info.queueFamilyIndexCount = 1;
-	uint32_t qfi = e.getQueueFamilyIndexGeneral();
-	vb_create_info.pQueueFamilyIndices = &qfi;
-	
-	vkCreateBuffer(e.getDevice(), &vb_create_info, VK_NULL_HANDLE, &m_vertex_buffer);
-	
-	/*Get memory requirements for buffer*/
-	VkMemoryRequirements vb_mem_req;
-	vkGetBufferMemoryRequirements(e.getDevice(), m_vertex_buffer, &vb_mem_req);
-	
-	VkMemoryAllocateInfo vb_mem_alloc_info{};
-	vb_mem_alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	vb_mem_alloc_info.pNext = NULL;
-	vb_mem_alloc_info.allocationSize = vb_mem_req.size;
-	vb_mem_alloc_info.memoryTypeIndex = findMemoryTypeIndex(vb_mem_req.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-	
-	/*Allocate memory for the buffer*/
-	vkAllocateMemory(e.getDevice(), &vb_mem_alloc_info, VK_NULL_HANDLE, &m_vertex_buffer_memory);
-	
-	/*Map buffer memory*/
-	Vertex* mem;
-	vkMapMemory(e.getDevice(), m_vertex_buffer_memory, 0, VK_WHOLE_SIZE, 0, (void**)&mem);
-	
-	const uint32_t numVerts = constants.res_x * constants.res_y;
-	
-	/*Generate random initial location for each vertex, within specified bounds*/
-	for(size_t v = 0; v < numVerts; v++)
-	{
-		mem[v].pos.x = (2*float((float)std::rand() / (float)RAND_MAX) - 1.0f) * x_bound;
-		mem[v].pos.y = (2*float((float)std::rand() / (float)RAND_MAX) - 1.0f) * y_bound;
-		mem[v].pos.z = (2*float((float)std::rand() / (float)RAND_MAX) - 1.0f) * z_bound;
+	const VkPhysicalDeviceLimits& limits = e.getPhyDevProps().limits;
+	
+	VkFormatProperties format_props;
+	vkGetPhysicalDeviceFormatProperties(e.getPhysicalDevice(), ParticleViewFormat(particle_format), &format_props);
+	if(!(format_props.bufferFeatures & VK_FORMAT_FEATURE_STORAGE_TEXEL_BUFFER_BIT))
+		std::cout << "Error: Particle format " << ParticleFormatToString(particle_format) << " is not supported for storage texel buffers." << '\n';
+	
+	/*Chunks are independent particle systems, each within the texel buffer, storage buffer and dispatch limits
+	of the device and small enough that a single allocation never gets large.
+	Devices report up to 2^31 - 1 workgroups, the particles they cover overflow 32 bits.*/
+	const uint64_t dispatch_particles = std::min<uint64_t>((uint64_t)limits.maxComputeWorkGroupCount[0] * SimGroupSize(limits), UINT32_MAX);
+	uint32_t chunk_size = std::min({particle_chunk_size, limits.maxTexelBufferElements / ParticleTexels(particle_format),
+		(uint32_t)((limits.maxStorageBufferRange - sizeof(VisibleListHeader)) / sizeof(uint32_t)),
+		(uint32_t)dispatch_particles});
+	
+	m_chunks.resize((m_particle_count + chunk_size - 1) / chunk_size);
+	for(uint32_t c = 0; c < m_chunks.size(); c++)
+	{
+		m_chunks[c].first = c * chunk_size;
+		m_chunks[c].count = std::min(chunk_size, m_particle_count - c * chunk_size);
 	}
 	
-	/*Unmap buffer memory*/
-	vkUnmapMemory(e.getDevice(), m_vertex_buffer_memory);
+	std::cout << "Particles: " << m_particle_count << " in " << m_chunks.size() << (m_chunks.size() == 1 ? " chunk" : " chunks")
+		<< ", format " << ParticleFormatToString(particle_format) << ", " << ParticleSize(particle_format) << " bytes per particle" << '\n';
 	
-	/*Bind memory to the buffer*/
-	vkBindBufferMemory(e.getDevice(), m_vertex_buffer, m_vertex_buffer_memory, 0);
+	/*---Creating buffers---*/
 	
-	/*---Create vertex buffer view---*/
+	auto create_buffer = [&e](ParticleBuffer& p, VkDeviceSize size, VkBufferUsageFlags usage)
+	{
+		VkBufferCreateInfo buffer_create_info{};
+		buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		buffer_create_info.pNext = NULL;
+		buffer_create_info.flags = 0;
+		buffer_create_info.size = size;
+		buffer_create_info.usage = usage;
+		buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		
+		if(vkCreateBuffer(e.getDevice(), &buffer_create_info, VK_NULL_HANDLE, &p.buffer) < 0)
+		{
+			p.buffer = VK_NULL_HANDLE;
+			return false;
+		}
+		
+		/*read and written by the GPU every frame, the host only sees it through the debug readback*/
+		return e.getAllocator().allocateBuffer(p.buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, MemoryTag::Particles, p.mem, AllocationStrategy::Linear);
+	};
 	
+	/*Specify usage as storage texel buffer to store formatted vertex data,
+	that can be read and written inside shaders*/
 	VkBufferViewCreateInfo vb_view_create_info{};
 	vb_view_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO;
 	vb_view_create_info.pNext = NULL;
 	vb_view_create_info.flags = 0;
-	vb_view_create_info.buffer = m_vertex_buffer;
-	vb_view_create_info.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	vb_view_create_info.format = ParticleViewFormat(particle_format);
 	vb_view_create_info.offset = 0;
 	vb_view_create_info.range = VK_WHOLE_SIZE;
 	
-	vkCreateBufferView(e.getDevice(), &vb_view_create_info, VK_NULL_HANDLE, &m_vertex_buffer_view);
-}
-
-void MyScene::initDescriptorSets()
-{
-	VkDevice d = VulkanEngine::get().getDevice();
-	
-	/*---Create descriptor set layout---*/
+	const VkBufferUsageFlags list_usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 	
-	VkDescriptorSetLayoutBinding vb_binding{};
+	for(uint32_t c = 0; c < m_chunks.size(); c++)
+	{
+		ParticleChunk& chunk = m_chunks[c];
+		bool created = true;
+		
+		for(auto& p : chunk.positions)
+		{
+			created = created && create_buffer(p, ParticleSize(particle_format) * chunk.count, VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+			
+			vb_view_create_info.buffer = p.buffer;
+			created = created && vkCreateBufferView(e.getDevice(), &vb_view_create_info, VK_NULL_HANDLE, &p.view) >= 0;
+		}
+		
+		created = created && create_buffer(chunk.targets, sizeof(uint32_t) * chunk.count, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+		created = created && create_buffer(chunk.states, sizeof(uint32_t) * chunk.count, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+		
+		/*the headers are the indirect dispatch and draw, their counts are copied out for the metrics*/
+		for(auto& l : chunk.active_lists)
+			created = created && create_buffer(l, sizeof(ActiveListHeader) + sizeof(uint32_t) * chunk.count, list_usage);
+		
+		for(auto& l : chunk.visible_lists)
+			created = created && create_buffer(l, sizeof(VisibleListHeader) + sizeof(uint32_t) * chunk.count, list_usage);
+		
+		/*out of device memory, the chunks created so far are simulated and drawn, the rest are dropped*/
+		if(!created)
+		{
+			std::cout << "Error: Failed to create particle buffers for chunk " << c << ", continuing with " << chunk.first << " particles." << '\n';
+			
+			for(uint32_t d = c; d < m_chunks.size(); d++)
+				m_chunks[d].destroy();
+			
+			m_particle_count = chunk.first;
+			m_chunks.resize(c);
+			break;
+		}
+	}
+	
+	VkBufferCreateInfo counts_create_info{};
+	counts_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	counts_create_info.pNext = NULL;
+	counts_create_info.flags = 0;
+	counts_create_info.size = sizeof(ParticleCounts) * std::max<size_t>(1, m_chunks.size()) * m_frames.size();
+	counts_create_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	counts_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	
+	vkCreateBuffer(e.getDevice(), &counts_create_info, VK_NULL_HANDLE, &m_particle_counts.buffer);
+	if(!e.getAllocator().allocateBuffer(m_particle_counts.buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT, MemoryTag::Particles, m_particle_counts.mem))
+	{
+		/*the counts are only metrics, frames are recorded without them*/
+		std::cout << "Error: Failed to allocate particle count memory." << '\n';
+		vkDestroyBuffer(e.getDevice(), m_particle_counts.buffer, VK_NULL_HANDLE);
+		m_particle_counts.buffer = VK_NULL_HANDLE;
+	}
+	
+	/*the states and the first lists are cleared by the first frame, see render()*/
+	m_active_reset_pending = true;
+	
+	/*the first frame simulates out of positions 0, the others are written before they are read.
+	By default the first frame seeds them and the targets on the device, see render()*/
+	if(!seed_on_host)
+	{
+		m_seed_pending = true;
+		return;
+	}
+	
+	/*the host path seeds in staging buffers and copies them on the transfer queue*/
+	VulkanTransfer& transfer = e.getTransfer();
+	TransferBatch* batch = transfer.begin();
+	
+	const ParticleFormat format = particle_format;
+	const uint32_t seed = particle_seed;
+	const glm::uvec2 grid = m_particle_grid;
+	
+	for(auto& chunk : m_chunks)
+	{
+		const uint32_t first = chunk.first;
+		const uint32_t count = chunk.count;
+		
+		void* pos_ptr;
+		VkBuffer pos_staging = transfer.createStagingBuffer(batch, ParticleSize(format) * count, &pos_ptr);
+		void* target_ptr;
+		VkBuffer target_staging = transfer.createStagingBuffer(batch, sizeof(uint32_t) * count, &target_ptr);
+		
+		/*Random initial location for each vertex within the bounds. The hash has no state carried between
+		particles, so the ranges are filled in parallel and the loop has no dependency between iterations.*/
+		e.getJobs().parallelFor(count, 1 << 16, [pos_ptr, target_ptr, format, first, count, seed, grid](uint32_t begin, uint32_t end)
+		{
+			for(uint32_t v = begin; v < end; v++)
+			{
+				StoreParticle(format, pos_ptr, count, v, SeedParticle(seed, first + v));
+				((uint32_t*)target_ptr)[v] = ParticleTarget(grid, first + v);
+			}
+		});
+		
+		VkBufferCopy pos_region{0, 0, ParticleSize(format) * count};
+		e.getDispatch().vkCmdCopyBuffer(batch->cmd_buf, pos_staging, chunk.positions[0].buffer, 1, &pos_region);
+		VkBufferCopy target_region{0, 0, sizeof(uint32_t) * count};
+		e.getDispatch().vkCmdCopyBuffer(batch->cmd_buf, target_staging, chunk.targets.buffer, 1, &target_region);
+		
+		/*the first simulation step reads the positions, the targets are read by every step and draw*/
+		transfer.releaseToGraphics(batch, chunk.positions[0].buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		transfer.releaseToGraphics(batch, chunk.targets.buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
+	}
+	
+	transfer.submit(batch);
+}
+
+void MyScene::initParticleReadback()
+{
+	VulkanEngine& e = VulkanEngine::get();
+	
+	/*the chunks one after another*/
+	VkBufferCreateInfo rb_create_info{};
+	rb_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	rb_create_info.pNext = NULL;
+	rb_create_info.flags = 0;
+	rb_create_info.size = ParticleSize(particle_format) * m_particle_count;
+	rb_create_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	rb_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	
+	vkCreateBuffer(e.getDevice(), &rb_create_info, VK_NULL_HANDLE, &m_particle_readback.buffer);
+	
+	/*cached memory makes the host reads fast*/
+	e.getAllocator().allocateBuffer(m_particle_readback.buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT, MemoryTag::Particles, m_particle_readback.mem);
+}
+
+void MyScene::initDescriptorSetLayout()
+{
+	VkDevice d = VulkanEngine::get().getDevice();
+	
+	/*---Create descriptor set layout---*/
+	
+	VkDescriptorSetLayoutBinding vb_binding{};
 	vb_binding.binding = 0;
 	vb_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER;
 	vb_binding.descriptorCount = 1;
-	vb_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	vb_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
 	vb_binding.pImmutableSamplers = NULL;
 	
 	VkDescriptorSetLayoutBinding img_binding{};
@@ -723,7 +937,39 @@ void MyScene::initDescriptorSets()
 	img_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 	img_binding.pImmutableSamplers = &m_sampler;
 	
-	std::vector<VkDescriptorSetLayoutBinding> bindings{vb_binding, img_binding};
+	/*particle state of the previous step, the simulation reads it and writes binding 0*/
+	VkDescriptorSetLayoutBinding prev_binding{};
+	prev_binding.binding = 2;
+	prev_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER;
+	prev_binding.descriptorCount = 1;
+	prev_binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	prev_binding.pImmutableSamplers = NULL;
+	
+	/*particle states, the step's active list and the next step's, see ParticleChunk*/
+	VkDescriptorSetLayoutBinding states_binding{};
+	states_binding.binding = 3;
+	states_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	states_binding.descriptorCount = 1;
+	states_binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	states_binding.pImmutableSamplers = NULL;
+	
+	VkDescriptorSetLayoutBinding list_binding = states_binding;
+	list_binding.binding = 4;
+	
+	VkDescriptorSetLayoutBinding next_list_binding = states_binding;
+	next_list_binding.binding = 5;
+	
+	/*filled by the simulation, the draw reads the particles to draw from it*/
+	VkDescriptorSetLayoutBinding visible_binding = states_binding;
+	visible_binding.binding = 6;
+	visible_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+	
+	/*where each particle settles, its texture coordinate*/
+	VkDescriptorSetLayoutBinding targets_binding = visible_binding;
+	targets_binding.binding = 7;
+	
+	std::vector<VkDescriptorSetLayoutBinding> bindings{vb_binding, img_binding, prev_binding, states_binding, list_binding, next_list_binding,
+		visible_binding, targets_binding};
 	
 	VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info{};
 	desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -733,19 +979,29 @@ void MyScene::initDescriptorSets()
 	desc_set_layout_create_info.pBindings = bindings.data();
 	
 	vkCreateDescriptorSetLayout(d, &desc_set_layout_create_info, VK_NULL_HANDLE, &m_descriptor_set_layout);
+}
+
+void MyScene::initDescriptorSets()
+{
+	VkDevice d = VulkanEngine::get().getDevice();
 	
 	/*---Create descriptor pool---*/
 	
+	/*one set per chunk and particle buffer, each simulating from the buffer before it.
+	A pool needs room for a set even if no chunk could be created.*/
+	const uint32_t set_count = std::max<uint32_t>(1, m_chunks.size()) * particle_buffer_count;
+	
 	std::vector<VkDescriptorPoolSize> pool_sizes{
-		{VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER, 1},
-		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1}
+		{VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER, 2 * set_count},
+		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, set_count},
+		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5 * set_count}
 	};
 	
 	VkDescriptorPoolCreateInfo desc_pool_create_info{};
 	desc_pool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	desc_pool_create_info.pNext = NULL;
 	desc_pool_create_info.flags = 0;
-	desc_pool_create_info.maxSets = 1;
+	desc_pool_create_info.maxSets = set_count;
 	desc_pool_create_info.poolSizeCount = pool_sizes.size();
 	desc_pool_create_info.pPoolSizes = pool_sizes.data();
 	
@@ -755,39 +1011,81 @@ void MyScene::initDescriptorSets()
 	desc_set_allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	desc_set_allocate_info.pNext = NULL;
 	desc_set_allocate_info.descriptorPool = m_descriptor_pool;
-	desc_set_allocate_info.descriptorSetCount = 1;
-	desc_set_allocate_info.pSetLayouts = &m_descriptor_set_layout;
-	
-	vkAllocateDescriptorSets(d, &desc_set_allocate_info, &m_descriptor_set);
+	std::vector<VkDescriptorSetLayout> set_layouts(particle_buffer_count, m_descriptor_set_layout);
+	desc_set_allocate_info.descriptorSetCount = particle_buffer_count;
+	desc_set_allocate_info.pSetLayouts = set_layouts.data();
 	
-	VkWriteDescriptorSet vb_write{};
-	vb_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	vb_write.pNext = NULL;
-	vb_write.dstSet = m_descriptor_set;
-	vb_write.dstBinding = 0;
-	vb_write.dstArrayElement = 0;
-	vb_write.descriptorCount = 1;
-	vb_write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER;
-	vb_write.pTexelBufferView = &m_vertex_buffer_view;
+	for(auto& chunk : m_chunks)
+	{
+		vkAllocateDescriptorSets(d, &desc_set_allocate_info, chunk.descriptor_sets);
+	}
 	
 	VkDescriptorImageInfo img_info{};
 	img_info.sampler = m_sampler;
 	img_info.imageView = m_image_view;
 	img_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 	
-	VkWriteDescriptorSet img_write{};
-	img_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	img_write.pNext = NULL;
-	img_write.dstSet = m_descriptor_set;
-	img_write.dstBinding = 1;
-	img_write.dstArrayElement = 0;
-	img_write.descriptorCount = 1;
-	img_write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	img_write.pImageInfo = &img_info;
+	std::vector<VkWriteDescriptorSet> writes;
 	
-	std::vector<VkWriteDescriptorSet> writes{vb_write, img_write};
+	/*the lists alternate with the buffers*/
+	std::vector<VkDescriptorBufferInfo> buffer_infos;
+	buffer_infos.reserve(5 * set_count);
 	
-	vkUpdateDescriptorSets(d, writes.size(), writes.data(), 0, NULL);
+	/*Set i simulates from buffer i into buffer i+1, which the draw then reads,
+	over the particles in list i, appending those still moving to list i+1. Like buffer i+1,
+	visible list i+1 is filled by that step and read by its draw.*/
+	for(auto& chunk : m_chunks)
+	{
+		for(uint32_t i = 0; i < particle_buffer_count; i++)
+		{
+			const uint32_t next = (i + 1) % particle_buffer_count;
+			
+			VkWriteDescriptorSet vb_write{};
+			vb_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			vb_write.pNext = NULL;
+			vb_write.dstSet = chunk.descriptor_sets[i];
+			vb_write.dstBinding = 0;
+			vb_write.dstArrayElement = 0;
+			vb_write.descriptorCount = 1;
+			vb_write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER;
+			vb_write.pTexelBufferView = &chunk.positions[next].view;
+			
+			VkWriteDescriptorSet img_write{};
+			img_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			img_write.pNext = NULL;
+			img_write.dstSet = chunk.descriptor_sets[i];
+			img_write.dstBinding = 1;
+			img_write.dstArrayElement = 0;
+			img_write.descriptorCount = 1;
+			img_write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			img_write.pImageInfo = &img_info;
+			
+			VkWriteDescriptorSet prev_write = vb_write;
+			prev_write.dstBinding = 2;
+			prev_write.pTexelBufferView = &chunk.positions[i].view;
+			
+			writes.push_back(vb_write);
+			writes.push_back(img_write);
+			writes.push_back(prev_write);
+			
+			/*bindings 3 to 7*/
+			const VkBuffer storage[5] = {chunk.states.buffer, chunk.active_lists[i].buffer, chunk.active_lists[next].buffer,
+				chunk.visible_lists[next].buffer, chunk.targets.buffer};
+			for(uint32_t b = 0; b < 5; b++)
+			{
+				buffer_infos.push_back(VkDescriptorBufferInfo{storage[b], 0, VK_WHOLE_SIZE});
+				
+				VkWriteDescriptorSet storage_write = vb_write;
+				storage_write.dstBinding = 3 + b;
+				storage_write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				storage_write.pTexelBufferView = NULL;
+				storage_write.pBufferInfo = &buffer_infos.back();
+				writes.push_back(storage_write);
+			}
+		}
+	}
+	
+	VulkanEngine::get().getDispatch().vkUpdateDescriptorSets(d, writes.size(), writes.data(), 0, NULL);
 }
 
 void MyScene::initGraphicsPipeline()
@@ -831,24 +1129,24 @@ void MyScene::initGraphicsPipeline()
 	input_assembly_state.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
 	input_assembly_state.primitiveRestartEnable = VK_FALSE;
 	
-	VkViewport viewport;
-	viewport.x = 0;
-	viewport.y = 0;
-	viewport.width = VulkanEngine::get().getSurfaceExtent().width;
-	viewport.height = VulkanEngine::get().getSurfaceExtent().height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-	
-	VkRect2D scissors{VkOffset2D{0,0}, VulkanEngine::get().getSurfaceExtent()};
-	
+	/*viewport and scissor are set when recording, so a resize doesn't invalidate the pipeline*/
 	VkPipelineViewportStateCreateInfo viewport_state{};
 	viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewport_state.pNext = NULL;
 	viewport_state.flags = 0;
 	viewport_state.viewportCount = 1;
-	viewport_state.pViewports = &viewport;
+	viewport_state.pViewports = NULL;
 	viewport_state.scissorCount = 1;
-	viewport_state.pScissors = &scissors;
+	viewport_state.pScissors = NULL;
+	
+	VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+	
+	VkPipelineDynamicStateCreateInfo dynamic_state{};
+	dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamic_state.pNext = NULL;
+	dynamic_state.flags = 0;
+	dynamic_state.dynamicStateCount = 2;
+	dynamic_state.pDynamicStates = dynamic_states;
 	
 	VkPipelineRasterizationStateCreateInfo rast_state{};
 	rast_state.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -930,24 +1228,140 @@ void MyScene::initGraphicsPipeline()
 	g_pipeline_create_info.pMultisampleState = &multi_state;
 	g_pipeline_create_info.pDepthStencilState = &depth_stensil_state;
 	g_pipeline_create_info.pColorBlendState = &blend_state;
-	g_pipeline_create_info.pDynamicState = NULL;
+	g_pipeline_create_info.pDynamicState = &dynamic_state;
 	g_pipeline_create_info.layout = m_pipeline_layout;
 	g_pipeline_create_info.renderPass = m_render_pass;
 	g_pipeline_create_info.subpass = 0;
 	g_pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
 	g_pipeline_create_info.basePipelineIndex = -1;
 	
-	vkCreateGraphicsPipelines(VulkanEngine::get().getDevice(), VK_NULL_HANDLE, 1, &g_pipeline_create_info, VK_NULL_HANDLE, &m_graphics_pipeline);
+	VulkanEngine::get().createGraphicsPipelines(1, &g_pipeline_create_info, &m_graphics_pipeline);
+}
+
+void MyScene::initComputePipeline()
+{
+	VulkanEngine& e = VulkanEngine::get();
+	
+	auto cs = std::make_unique<Shader>("sim.spv");
+	auto seed_cs = std::make_unique<Shader>("seed.spv");
+	auto wake_cs = std::make_unique<Shader>("wake.spv");
+	
+	/*workgroup size within the device limits, the shaders read it as specialization constant 0,
+	seed.comp reads the seed as constant 1 and the grid as 2 and 3. The indirect dispatch counts groups of the same size.*/
+	m_sim_group_size = SimGroupSize(e.getPhyDevProps().limits);
+	
+	const uint32_t spec_data[4] = {m_sim_group_size, particle_seed, m_particle_grid.x, m_particle_grid.y};
+	VkSpecializationMapEntry spec_entries[4] = {{0, 0, sizeof(uint32_t)}, {1, sizeof(uint32_t), sizeof(uint32_t)},
+		{2, 2 * sizeof(uint32_t), sizeof(uint32_t)}, {3, 3 * sizeof(uint32_t), sizeof(uint32_t)}};
+	
+	VkSpecializationInfo spec_info{};
+	spec_info.mapEntryCount = 4;
+	spec_info.pMapEntries = spec_entries;
+	spec_info.dataSize = sizeof(spec_data);
+	spec_info.pData = spec_data;
+	
+	VkPipelineShaderStageCreateInfo cs_stage{};
+	cs_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	cs_stage.pNext = NULL;
+	cs_stage.flags = 0;
+	cs_stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	cs_stage.module = cs->getModule();
+	cs_stage.pName = "main";
+	cs_stage.pSpecializationInfo = &spec_info;
+	
+	/*same constants as the draw, the simulation only uses the ones after the matrix*/
+	VkPushConstantRange constant_ranges{};
+	constant_ranges.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	constant_ranges.offset = 0;
+	constant_ranges.size = sizeof(s_constants);
+	
+	VkPipelineLayoutCreateInfo layout_info{};
+	layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layout_info.pNext = NULL;
+	layout_info.flags = 0;
+	layout_info.setLayoutCount = 1;
+	layout_info.pSetLayouts = &m_descriptor_set_layout;
+	layout_info.pushConstantRangeCount = 1;
+	layout_info.pPushConstantRanges = &constant_ranges;
+	
+	vkCreatePipelineLayout(e.getDevice(), &layout_info, VK_NULL_HANDLE, &m_compute_pipeline_layout);
+	
+	VkComputePipelineCreateInfo c_pipeline_create_info[3]{};
+	c_pipeline_create_info[0].sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	c_pipeline_create_info[0].pNext = NULL;
+	c_pipeline_create_info[0].flags = 0;
+	c_pipeline_create_info[0].stage = cs_stage;
+	c_pipeline_create_info[0].layout = m_compute_pipeline_layout;
+	c_pipeline_create_info[0].basePipelineHandle = VK_NULL_HANDLE;
+	c_pipeline_create_info[0].basePipelineIndex = -1;
+	
+	/*the seeding shares the layout, it writes binding 0 of the last step's set, which is buffer 0*/
+	c_pipeline_create_info[1] = c_pipeline_create_info[0];
+	c_pipeline_create_info[1].stage.module = seed_cs->getModule();
+	
+	c_pipeline_create_info[2] = c_pipeline_create_info[0];
+	c_pipeline_create_info[2].stage.module = wake_cs->getModule();
+	
+	VkPipeline pipelines[3];
+	e.createComputePipelines(3, c_pipeline_create_info, pipelines);
+	m_compute_pipeline = pipelines[0];
+	m_seed_pipeline = pipelines[1];
+	m_wake_pipeline = pipelines[2];
+	
+	std::cout << "Particle simulation: workgroups of " << m_sim_group_size << '\n';
+}
+
+void MyScene::destroyComputePipeline()
+{
+	VkDevice d = VulkanEngine::get().getDevice();
+	
+	if(m_compute_pipeline != VK_NULL_HANDLE)
+	{
+		vkDestroyPipeline(d, m_compute_pipeline, VK_NULL_HANDLE);
+		m_compute_pipeline = VK_NULL_HANDLE;
+	}
+	
+	if(m_seed_pipeline != VK_NULL_HANDLE)
+	{
+		vkDestroyPipeline(d, m_seed_pipeline, VK_NULL_HANDLE);
+		m_seed_pipeline = VK_NULL_HANDLE;
+	}
+	
+	if(m_wake_pipeline != VK_NULL_HANDLE)
+	{
+		vkDestroyPipeline(d, m_wake_pipeline, VK_NULL_HANDLE);
+		m_wake_pipeline = VK_NULL_HANDLE;
+	}
+	
+	if(m_compute_pipeline_layout != VK_NULL_HANDLE)
+	{
+		vkDestroyPipelineLayout(d, m_compute_pipeline_layout, VK_NULL_HANDLE);
+		m_compute_pipeline_layout = VK_NULL_HANDLE;
+	}
 }
 
 void MyScene::destroy()
 {
 	VkDevice d = VulkanEngine::get().getDevice();
 	
+	/*the engine may be switching scenes, only this scene's frames have to complete*/
+	waitForFrames();
+	
+	/*the encoder may still be working on the last frames*/
+	VulkanEngine::get().getJobs().wait(m_record_job);
+	m_record_job.reset();
+	if(recording)
+	{
+		m_recorder.stopRecording();
+		recording = false;
+	}
+	
 	destroySynchronizationObjects();
 	
 	destroySurfaceDependentObjects();
 	
+	destroyComputePipeline();
+	
 	for(auto& ri : m_record_images)
 	{
 		ri.destroy();
@@ -967,25 +1381,15 @@ void MyScene::destroy()
 		m_command_pool = VK_NULL_HANDLE;
 	}
 	
-	if(m_vertex_buffer_view != VK_NULL_HANDLE)
-	{
-		vkDestroyBufferView(d, m_vertex_buffer_view, VK_NULL_HANDLE);
-		m_vertex_buffer_view = VK_NULL_HANDLE;
-	}
-	
-	if(m_vertex_buffer != VK_NULL_HANDLE)
+	for(auto& c : m_chunks)
 	{
-		vkDestroyBuffer(d, m_vertex_buffer, VK_NULL_HANDLE);
-		m_vertex_buffer = VK_NULL_HANDLE;
+		c.destroy();
 	}
+	m_chunks.clear();
+	m_particle_readback.destroy();
+	m_particle_counts.destroy();
 	
-	if(m_vertex_buffer_memory != VK_NULL_HANDLE)
-	{
-		vkFreeMemory(d, m_vertex_buffer_memory, VK_NULL_HANDLE);
-		m_vertex_buffer_memory = VK_NULL_HANDLE;
-	}
-	
-	if(m_descriptor_set != VK_NULL_HANDLE)
+	if(m_descriptor_pool != VK_NULL_HANDLE)
 	{
 		vkDestroyDescriptorPool(d, m_descriptor_pool, VK_NULL_HANDLE);
 		m_descriptor_pool = VK_NULL_HANDLE;
@@ -1008,34 +1412,64 @@ Timer& MyScene::getTimer()
 	return m_timer;
 }
 
+void MyScene::waitForFrames()
+{
+	std::vector<VkFence> fences;
+	for(auto& f : m_frames)
+	{
+		fences.push_back(f.fence);
+	}
+	
+	VulkanEngine::get().getDispatch().vkWaitForFences(VulkanEngine::get().getDevice(), fences.size(), fences.data(), VK_TRUE, UINT64_MAX);
+}
+
 void MyScene::onResize()
 {
-	destroySurfaceDependentObjects();
+	/*nothing waits here, the old objects are handed to the engine's deletion queue and
+	destroyed once the frames in flight that may use them completed*/
+	
+	/*only framebuffer sized attachments depend on the extent, the render pass and
+	the pipeline survive unless the surface format changed*/
+	if(m_render_pass_format != VulkanEngine::get().getSurfaceFormat())
+		destroySurfaceDependentObjects();
+	else
+		destroyRenderTargets();
+	
+	/*the new swapchain may have a different number of images*/
+	if(m_record_images.size() != VulkanEngine::get().getSwapchainImages().size())
+	{
+		VulkanEngine::get().destroyLater([record_images = std::move(m_record_images)]() mutable
+		{
+			for(auto& ri : record_images)
+			{
+				ri.destroy();
+			}
+		});
+		m_record_images.clear();
+		
+		initRecordImages();
+	}
+	
 	initSurfaceDependentObjects();
 }
 
-void MyScene::recordFrame(uint32_t id)
+void MyScene::recordFrame(uint64_t readback, const Allocation& mem)
 {
-	VkDevice d = VulkanEngine::get().getDevice();
-	
-	vkWaitForFences(d, 1, &m_fences[id], VK_TRUE, UINT64_MAX);
+	/*wait for the transfer queue to finish the copy of this image*/
+	VulkanEngine::get().getTransfer().wait(readback);
 	
-	uint8_t* data;
-	vkMapMemory(d, m_record_images[id].img_mem1, 0, VK_WHOLE_SIZE, 0, (void**)&data);
+	/*cached memory may not be coherent*/
+	VulkanEngine::get().getAllocator().invalidate(mem);
 	
-	m_recorder.nextFrame(data);
-	
-	vkUnmapMemory(d, m_record_images[id].img_mem1);
+	m_recorder.nextFrame((uint8_t*)mem.mapped);
 }
 
-void takeSnapshot(VkFence fence, VkDeviceMemory mem)
+void takeSnapshot(uint64_t readback, const Allocation& mem)
 {
-	VkDevice d = VulkanEngine::get().getDevice();
+	VulkanEngine::get().getTransfer().wait(readback);
+	VulkanEngine::get().getAllocator().invalidate(mem);
 	
-	vkWaitForFences(d, 1, &fence, VK_TRUE, UINT64_MAX);
-	
-	uint8_t* data;
-	vkMapMemory(d, mem, 0, VK_WHOLE_SIZE, 0, (void**)&data);
+	uint8_t* data = (uint8_t*)mem.mapped;
 	
 	Blob blob(data, video_res_x*video_res_y*4*sizeof(uint8_t));
 	Image img;
@@ -1047,8 +1481,42 @@ void takeSnapshot(VkFence fence, VkDeviceMemory mem)
 	img.read(blob);
 	img.magick("PNG");
 	img.write("test.png");
+}
+
+/*Summary of a particle state read back from the device, for debugging the simulation*/
+void printParticleState(const Allocation& mem, const std::vector<ParticleChunk>& chunks, glm::uvec2 grid, uint32_t res_x, uint32_t res_y)
+{
+	VulkanEngine::get().getAllocator().invalidate(mem);
+	
+	uint32_t count = 0;
+	uint32_t settled = 0;
+	glm::vec3 min_pos(FLT_MAX), max_pos(-FLT_MAX);
+	
+	/*the chunks were copied one after another, each in its own layout*/
+	const uint8_t* chunk_data = (const uint8_t*)mem.mapped;
+	
+	for(auto& chunk : chunks)
+	{
+		for(uint32_t i = 0; i < chunk.count; i++)
+		{
+			/*same destination as the simulation, a grid in the z = 0 plane*/
+			glm::vec3 dest = TargetPosition(ParticleTarget(grid, chunk.first + i), res_x, res_y);
+			glm::vec3 pos = LoadParticle(particle_format, chunk_data, chunk.count, i);
+			
+			if(glm::length(dest - pos) < ParticleEpsilon(particle_format))
+				settled++;
+			
+			min_pos = glm::min(min_pos, pos);
+			max_pos = glm::max(max_pos, pos);
+		}
+		
+		count += chunk.count;
+		chunk_data += ParticleSize(particle_format) * chunk.count;
+	}
 	
-	vkUnmapMemory(d, mem);
+	std::cout << "Particles: " << settled << " of " << count << " settled, bounds ("
+		<< min_pos.x << ", " << min_pos.y << ", " << min_pos.z << ") to ("
+		<< max_pos.x << ", " << max_pos.y << ", " << max_pos.z << ")" << '\n';
 }
 
 void MyScene::update()
@@ -1067,7 +1535,10 @@ void MyScene::update()
 	constants.vp = m_camera->getViewProj();
 	
 	constants.eyeW = m_camera->getCamPosW();
-	constants.curDirNW = glm::normalize(glm::affineInverse(m_camera->getView()) * glm::vec4(m_camera->getCurPosProj(*VulkanEngine::get().getWindow()), 0.0f));
+	/*without a window (headless) the cursor is considered to be in the middle of the screen*/
+	auto& window = VulkanEngine::get().getWindow();
+	glm::vec3 cur_pos_proj = window ? m_camera->getCurPosProj(*window) : m_camera->getCurPosProj(std::pair<float, float>(0.0f, 0.0f));
+	constants.curDirNW = glm::normalize(glm::affineInverse(m_camera->getView()) * glm::vec4(cur_pos_proj, 0.0f));
 }
 
 void MyScene::render()
@@ -1075,10 +1546,70 @@ void MyScene::render()
 	update();
 	
 	VulkanEngine& e = VulkanEngine::get();
+	DeviceDispatch& vk = e.getDispatch();
+	
+	/*frame slots are reused in order, so waiting on the slot's fence only waits for the frame
+	submitted frames_in_flight frames ago, not for the previous one*/
+	const uint32_t slot = m_frame_index % m_frames.size();
+	FrameContext& frame = m_frames[slot];
+	
+	vk.vkWaitForFences(e.getDevice(), 1, &frame.fence, VK_TRUE, UINT64_MAX);
+	
+	/*the slot's last frame completed, its simulation timestamps are available without waiting*/
+	if(frame.sim_timed)
+	{
+		uint64_t timestamps[2];
+		if(vk.vkGetQueryPoolResults(e.getDevice(), m_sim_queries, 2 * slot, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+		{
+			double ms = (timestamps[1] - timestamps[0]) * e.getPhyDevProps().limits.timestampPeriod / 1e6;
+			m_sim_time_ms = m_sim_time_ms == 0.0 ? ms : 0.9 * m_sim_time_ms + 0.1 * ms;
+		}
+		frame.sim_timed = false;
+	}
+	
+	if(frame.particles_counted)
+	{
+		e.getAllocator().invalidate(m_particle_counts.mem);
+		const ParticleCounts* counts = (const ParticleCounts*)m_particle_counts.mem.mapped + m_chunks.size() * slot;
+		
+		uint32_t active = 0, visible = 0, culled = 0;
+		for(size_t c = 0; c < m_chunks.size(); c++)
+		{
+			active += counts[c].active;
+			visible += counts[c].visible;
+			culled += counts[c].culled;
+		}
+		m_settled_count = m_particle_count - active;
+		m_visible_count = visible;
+		m_culled_count = culled;
+		frame.particles_counted = false;
+	}
+	
+	if(frame.particle_readback)
+	{
+		printParticleState(m_particle_readback.mem, m_chunks, m_particle_grid, frame.constants.res_x, frame.constants.res_y);
+		frame.particle_readback = false;
+		m_particle_readback_pending = false;
+	}
+	
+	/*the engine recreates an out of date swapchain itself, if there still is no image
+	(e.g. the window is minimized) skip the frame, the slot's fence stays signalled*/
 	uint32_t image_index;
-	vkAcquireNextImageKHR(e.getDevice(), e.getSwapchain(), UINT64_MAX, m_semaphores[s_acquire_image], VK_NULL_HANDLE, &image_index);
+	VkResult res = e.acquireNextImage(frame.sem_acquire, &image_index);
+	if(res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR)
+		return;
+	
+	/*the image's render target may still be used by a different frame slot*/
+	if(m_image_fences[image_index] != VK_NULL_HANDLE && m_image_fences[image_index] != frame.fence)
+	{
+		vk.vkWaitForFences(e.getDevice(), 1, &m_image_fences[image_index], VK_TRUE, UINT64_MAX);
+	}
+	m_image_fences[image_index] = frame.fence;
 	
-	VkCommandBuffer cmd_buf = m_command_buffers[image_index];
+	/*keep this frame's copy of the constants, update() is free to change the global ones for the next frame*/
+	frame.constants = constants;
+	
+	VkCommandBuffer cmd_buf = frame.cmd_buf;
 	
 	VkCommandBufferBeginInfo command_buffer_begin_info{};
 	command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -1086,28 +1617,229 @@ void MyScene::render()
 	command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 	command_buffer_begin_info.pInheritanceInfo = NULL;
 	
-	vkWaitForFences(e.getDevice(), 1, &m_fences[image_index], VK_TRUE, UINT64_MAX);
+	vk.vkBeginCommandBuffer(cmd_buf, &command_buffer_begin_info);
+	
+	/*---Simulation---*/
+	
+	/*Ping-pong: this step reads the state the previous step wrote and writes the next buffer, the draw reads what
+	it wrote. The buffer it overwrites was last read by the vertex shader of an earlier frame's draw, which may
+	still be running with more than two frames in flight, so the step waits for earlier vertex shading too.*/
+	const uint32_t step = m_frame_index % particle_buffer_count;
+	const uint32_t next = (step + 1) % particle_buffer_count;
+	
+	/*every chunk is a particle system of its own, each pass is recorded for all of them between the same barriers*/
+	auto bind_chunk = [&](const ParticleChunk& chunk, VkPipelineBindPoint bind_point, VkPipelineLayout layout, VkShaderStageFlags stages, uint32_t set)
+	{
+		s_constants chunk_constants = frame.constants;
+		chunk_constants.first = chunk.first;
+		chunk_constants.count = chunk.count;
+		
+		vk.vkCmdPushConstants(cmd_buf, layout, stages, 0, sizeof(s_constants), &chunk_constants);
+		vk.vkCmdBindDescriptorSets(cmd_buf, bind_point, layout, 0, 1, &chunk.descriptor_sets[set], 0, NULL);
+	};
+	
+	auto group_count = [this](const ParticleChunk& chunk) { return (chunk.count + m_sim_group_size - 1) / m_sim_group_size; };
+	
+	/*the first step reads positions 0, seed them right before, the barrier below covers the write.
+	The last step's set writes positions 0.*/
+	const bool seeded = m_seed_pending;
+	if(m_seed_pending)
+	{
+		vk.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, m_seed_pipeline);
+		for(auto& chunk : m_chunks)
+		{
+			bind_chunk(chunk, VK_PIPELINE_BIND_POINT_COMPUTE, m_compute_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, particle_buffer_count - 1);
+			vk.vkCmdDispatch(cmd_buf, group_count(chunk), 1, 1);
+		}
+		m_seed_pending = false;
+	}
+	
+	/*the previous step's positions, states and list are read here, and the list it dispatched over is cleared.
+	The positions written here were read by earlier vertex shading, and the visible list reset here was consumed
+	by an earlier indirect draw and its vertex shading. The active list reset here had its count copied out by
+	the previous frame. A write after read only needs the stages.
+	Only compute and transfer wait, rasterization of earlier frames keeps running.*/
+	VkMemoryBarrier sim_to_sim{VK_STRUCTURE_TYPE_MEMORY_BARRIER, NULL, VK_ACCESS_SHADER_WRITE_BIT,
+	VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT};
+	
+	vk.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &sim_to_sim, 0, NULL, 0, NULL);
+	
+	/*the first step's list is built by the wake pass, from every particle in the PARTICLE_NEW (0) state*/
+	const ActiveListHeader empty_list{0, 1, 1, 0};
+	const VisibleListHeader empty_visible{{0, 1, 0, 0}, 0};
+	for(auto& chunk : m_chunks)
+	{
+		if(m_active_reset_pending)
+		{
+			vk.vkCmdFillBuffer(cmd_buf, chunk.states.buffer, 0, VK_WHOLE_SIZE, 0);
+			vk.vkCmdUpdateBuffer(cmd_buf, chunk.active_lists[step].buffer, 0, sizeof(empty_list), &empty_list);
+		}
+		vk.vkCmdUpdateBuffer(cmd_buf, chunk.active_lists[next].buffer, 0, sizeof(empty_list), &empty_list);
+		vk.vkCmdUpdateBuffer(cmd_buf, chunk.visible_lists[next].buffer, 0, sizeof(empty_visible), &empty_visible);
+	}
+	m_active_reset_pending = false;
+	
+	VkMemoryBarrier clear_to_sim{VK_STRUCTURE_TYPE_MEMORY_BARRIER, NULL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+	
+	vk.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clear_to_sim, 0, NULL, 0, NULL);
+	
+	if(m_sim_queries != VK_NULL_HANDLE)
+	{
+		vk.vkCmdResetQueryPool(cmd_buf, m_sim_queries, 2 * slot, 2);
+		vk.vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_sim_queries, 2 * slot);
+	}
+	
+	/*the wake pass only reads one state per particle, the simulation then runs over the particles still moving*/
+	vk.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, m_wake_pipeline);
+	for(auto& chunk : m_chunks)
+	{
+		bind_chunk(chunk, VK_PIPELINE_BIND_POINT_COMPUTE, m_compute_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, step);
+		vk.vkCmdDispatch(cmd_buf, group_count(chunk), 1, 1);
+	}
+	
+	VkMemoryBarrier wake_to_sim{VK_STRUCTURE_TYPE_MEMORY_BARRIER, NULL, VK_ACCESS_SHADER_WRITE_BIT,
+	VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT};
+	
+	vk.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &wake_to_sim, 0, NULL, 0, NULL);
+	
+	vk.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, m_compute_pipeline);
+	for(auto& chunk : m_chunks)
+	{
+		bind_chunk(chunk, VK_PIPELINE_BIND_POINT_COMPUTE, m_compute_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, step);
+		vk.vkCmdDispatchIndirect(cmd_buf, chunk.active_lists[step].buffer, 0);
+	}
+	
+	if(m_sim_queries != VK_NULL_HANDLE)
+	{
+		vk.vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, m_sim_queries, 2 * slot + 1);
+		frame.sim_timed = true;
+	}
+	
+	/*number of particles simulated, read once the frame completed*/
+	const bool count_particles = m_particle_counts.buffer != VK_NULL_HANDLE;
+	const VkDeviceSize counts_offset = sizeof(ParticleCounts) * m_chunks.size() * slot;
+	for(uint32_t c = 0; count_particles && c < m_chunks.size(); c++)
+	{
+		VkBufferCopy active_region{offsetof(ActiveListHeader, count), counts_offset + sizeof(ParticleCounts) * c + offsetof(ParticleCounts, active), sizeof(uint32_t)};
+		vk.vkCmdCopyBuffer(cmd_buf, m_chunks[c].active_lists[step].buffer, m_particle_counts.buffer, 1, &active_region);
+	}
+	
+	/*one readback at a time, it is copied out of the new state and read once the frame completed*/
+	const bool particle_readback = m_particle_readback_requested && !m_particle_readback_pending;
+	if(particle_readback)
+	{
+		if(m_particle_readback.buffer == VK_NULL_HANDLE)
+			initParticleReadback();
+		
+		m_particle_readback_requested = false;
+		m_particle_readback_pending = true;
+		frame.particle_readback = true;
+	}
+	
+	/*positions written by the simulation are read by the vertex shader, and by the readback copy,
+	the visible lists by the indirect draws, the vertex shader and the count copies. Seeding wrote the targets.*/
+	std::vector<VkBufferMemoryBarrier> sim_to_draw;
+	for(auto& chunk : m_chunks)
+	{
+		VkBufferMemoryBarrier positions{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER, NULL, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, chunk.positions[next].buffer, 0, VK_WHOLE_SIZE};
+		
+		if(particle_readback)
+			positions.dstAccessMask |= VK_ACCESS_TRANSFER_READ_BIT;
+		
+		VkBufferMemoryBarrier visible{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER, NULL, VK_ACCESS_SHADER_WRITE_BIT,
+		VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, chunk.visible_lists[next].buffer, 0, VK_WHOLE_SIZE};
+		
+		sim_to_draw.push_back(positions);
+		sim_to_draw.push_back(visible);
+		
+		if(seeded)
+		{
+			VkBufferMemoryBarrier targets{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER, NULL, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+			VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, chunk.targets.buffer, 0, VK_WHOLE_SIZE};
+			sim_to_draw.push_back(targets);
+		}
+	}
+	VkPipelineStageFlags sim_dst_stages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+	
+	vk.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, sim_dst_stages, 0, 0, NULL, sim_to_draw.size(), sim_to_draw.data(), 0, NULL);
+	
+	/*number of particles drawn and culled, read along with the number simulated*/
+	if(count_particles)
+	{
+		for(uint32_t c = 0; c < m_chunks.size(); c++)
+		{
+			const VkDeviceSize chunk_offset = counts_offset + sizeof(ParticleCounts) * c;
+			VkBufferCopy visible_regions[2]{
+				{offsetof(VisibleListHeader, draw) + offsetof(VkDrawIndirectCommand, vertexCount), chunk_offset + offsetof(ParticleCounts, visible), sizeof(uint32_t)},
+				{offsetof(VisibleListHeader, culled), chunk_offset + offsetof(ParticleCounts, culled), sizeof(uint32_t)}};
+			vk.vkCmdCopyBuffer(cmd_buf, m_chunks[c].visible_lists[next].buffer, m_particle_counts.buffer, 2, visible_regions);
+		}
+		
+		VkBufferMemoryBarrier counts_to_host{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER, NULL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT,
+		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, m_particle_counts.buffer, 0, VK_WHOLE_SIZE};
+		
+		vk.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1, &counts_to_host, 0, NULL);
+		frame.particles_counted = true;
+	}
+	
+	if(particle_readback)
+	{
+		/*the chunks one after another*/
+		VkDeviceSize offset = 0;
+		for(auto& chunk : m_chunks)
+		{
+			VkBufferCopy region{0, offset, ParticleSize(particle_format) * chunk.count};
+			vk.vkCmdCopyBuffer(cmd_buf, chunk.positions[next].buffer, m_particle_readback.buffer, 1, &region);
+			offset += region.size;
+		}
+		
+		VkBufferMemoryBarrier readback_to_host{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER, NULL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT,
+		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, m_particle_readback.buffer, 0, VK_WHOLE_SIZE};
+		
+		vk.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1, &readback_to_host, 0, NULL);
+	}
+	
+	/*---Draw---*/
 	
-	vkBeginCommandBuffer(cmd_buf, &command_buffer_begin_info);
+	vk.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphics_pipeline);
 	
-	vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphics_pipeline);
+	VkViewport viewport{0.0f, 0.0f, (float)e.getSurfaceExtent().width, (float)e.getSurfaceExtent().height, 0.0f, 1.0f};
+	VkRect2D scissor{VkOffset2D{0,0}, e.getSurfaceExtent()};
 	
-	vkCmdPushConstants(cmd_buf, m_pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(s_constants), &constants);
-	vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout, 0, 1, &m_descriptor_set, 0, NULL);
+	vk.vkCmdSetViewport(cmd_buf, 0, 1, &viewport);
+	vk.vkCmdSetScissor(cmd_buf, 0, 1, &scissor);
 	
-		vkCmdBeginRenderPass(cmd_buf, &m_render_targets[image_index].begin_info, VK_SUBPASS_CONTENTS_INLINE);
+		vk.vkCmdBeginRenderPass(cmd_buf, &m_render_targets[image_index].begin_info, VK_SUBPASS_CONTENTS_INLINE);
 	
-		vkCmdDraw(cmd_buf, constants.res_x*constants.res_y, 1, 0, 0);
+		for(auto& chunk : m_chunks)
+		{
+			bind_chunk(chunk, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, step);
+			vk.vkCmdDrawIndirect(cmd_buf, chunk.visible_lists[next].buffer, 0, 1, sizeof(VkDrawIndirectCommand));
+		}
 	
-		vkCmdEndRenderPass(cmd_buf);
+		vk.vkCmdEndRenderPass(cmd_buf);
 		
-	if(recording || snap)
+	/*the blit has to stay on the graphics queue, the copy to host visible memory runs on the transfer queue*/
+	VulkanTransfer& transfer = e.getTransfer();
+	const bool readback = recording || snap;
+	RecordImage& ri = m_record_images[image_index];
+	
+	if(readback)
 	{
+		/*the transfer queue may still be copying out of the record image's last frame,
+		and a snapshot or the encoder may still be reading it on the host*/
+		transfer.wait(ri.readback);
+		e.getJobs().wait(ri.host_job);
+		
 		VkImageMemoryBarrier img_to_trans_d{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, NULL, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
-		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, m_record_images[image_index].img,
+		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, ri.img,
 		{VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}};
 		
-		vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &img_to_trans_d);
+		vk.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &img_to_trans_d);
 		
 		VkImageBlit blit_reg{};
 		blit_reg.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
@@ -1117,19 +1849,41 @@ void MyScene::render()
 		blit_reg.dstOffsets[0] = {0, 0, 0};
 		blit_reg.dstOffsets[1] = {video_res_x, video_res_y, 1};
 		
-		vkCmdBlitImage(cmd_buf, m_render_targets[image_index].target_image.img, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_record_images[image_index].img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit_reg, VK_FILTER_NEAREST);
+		vk.vkCmdBlitImage(cmd_buf, m_render_targets[image_index].target_image.img, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, ri.img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit_reg, VK_FILTER_NEAREST);
 		
-		VkImageMemoryBarrier img_to_trans_s{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, NULL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, m_record_images[image_index].img,
-		{VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}};
+		transfer.releaseFromGraphics(cmd_buf, ri.img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+	}
+	vk.vkEndCommandBuffer(cmd_buf);
+	
+	VkPipelineStageFlags submit_wait_flags[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+	VkSemaphore submit_signal[] = {frame.sem_submit, frame.sem_readback};
+	
+	VkSubmitInfo submit_info{};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.pNext = NULL;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &cmd_buf;
+	submit_info.signalSemaphoreCount = readback ? 2 : 1;
+	submit_info.pSignalSemaphores = submit_signal;
+	submit_info.waitSemaphoreCount = 1;
+	submit_info.pWaitSemaphores = &frame.sem_acquire;
+	submit_info.pWaitDstStageMask = submit_wait_flags;
+	
+	vk.vkResetFences(e.getDevice(), 1, &frame.fence);
+	vk.vkQueueSubmit(m_queue, 1, &submit_info, frame.fence);
+	
+	if(readback)
+	{
+		TransferBatch* batch = transfer.begin();
+		
+		transfer.acquireFromGraphics(batch, ri.img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT);
 		
 		VkImageMemoryBarrier img1_to_trans_d{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, NULL, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
-		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, m_record_images[image_index].img1,
+		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, ri.img1,
 		{VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}};
 		
-		VkImageMemoryBarrier bar1[] = {img_to_trans_s, img1_to_trans_d};
-		
-		vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 2, bar1);
+		vk.vkCmdPipelineBarrier(batch->cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &img1_to_trans_d);
 		
 		VkImageCopy cpy{};
 		cpy.srcOffset = {0,0,0};
@@ -1138,52 +1892,41 @@ void MyScene::render()
 		cpy.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
 		cpy.extent = {video_res_x, video_res_y, 1};
 		
-		vkCmdCopyImage(cmd_buf, m_record_images[image_index].img, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_record_images[image_index].img1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &cpy);
+		vk.vkCmdCopyImage(batch->cmd_buf, ri.img, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, ri.img1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &cpy);
 		
-		VkImageMemoryBarrier img1_to_general{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, NULL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_MEMORY_READ_BIT,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, m_record_images[image_index].img1,
+		VkImageMemoryBarrier img1_to_general{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, NULL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, ri.img1,
 		{VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}};
 		
-		vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &img1_to_general);
+		vk.vkCmdPipelineBarrier(batch->cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 0, NULL, 1, &img1_to_general);
+		
+		ri.readback = transfer.submit(batch, frame.sem_readback, VK_PIPELINE_STAGE_TRANSFER_BIT);
 	}
-	vkEndCommandBuffer(cmd_buf);
 	
-	VkPipelineStageFlags submit_wait_flags[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+	e.present(frame.sem_submit, image_index);
 	
-	VkSubmitInfo submit_info{};
-	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submit_info.pNext = NULL;
-	submit_info.commandBufferCount = 1;
-	submit_info.pCommandBuffers = &cmd_buf;
-	submit_info.signalSemaphoreCount = 1;
-	submit_info.pSignalSemaphores = &m_semaphores[s_submit];
-	submit_info.waitSemaphoreCount = 1;
-	submit_info.pWaitSemaphores = &m_semaphores[s_acquire_image];
-	submit_info.pWaitDstStageMask = submit_wait_flags;
-	
-	vkResetFences(e.getDevice(), 1, &m_fences[image_index]);
-	vkQueueSubmit(m_queue, 1, &submit_info, m_fences[image_index]);
-	
-	VkPresentInfoKHR present_info{};
-	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	present_info.pImageIndices = &image_index;
-	present_info.pNext = NULL;
-	present_info.pResults = NULL;
-	present_info.swapchainCount = 1;
-	present_info.pSwapchains = &e.getSwapchain();
-	present_info.waitSemaphoreCount = 1;
-	present_info.pWaitSemaphores = &m_semaphores[s_submit];
-	
-	vkQueuePresentKHR(m_queue, &present_info);
+	/*host side of the readback runs on the job system, the jobs wait for the transfer themselves*/
+	JobSystem& jobs = e.getJobs();
 	
 	if(snap)
 	{
-		takeSnapshot(m_fences[image_index], m_record_images[image_index].img_mem1);
+		uint64_t serial = ri.readback;
+		Allocation mem = ri.img_mem1;
+		ri.host_job = jobs.schedule([serial, mem]{ takeSnapshot(serial, mem); }, {ri.host_job});
 		snap = false;
 	}
 	
 	if(recording)
-		auto f = std::async(std::launch::async, &MyScene::recordFrame, this, image_index);
+	{
+		/*frames have to reach the encoder in order, each one runs after the previous,
+		the record image may be retired by a resize before the job runs, so it gets a copy*/
+		uint64_t serial = ri.readback;
+		Allocation mem = ri.img_mem1;
+		m_record_job = jobs.schedule([this, serial, mem]{ recordFrame(serial, mem); }, {m_record_job, ri.host_job});
+		ri.host_job = m_record_job;
+	}
+	
+	m_frame_index++;
 }
 
 bool mov = false;
@@ -1209,6 +1952,8 @@ void MyScene::KeyPressed(keycode_t k)
 			}
 			else
 			{
+				VulkanEngine::get().getJobs().wait(m_record_job);
+				m_record_job.reset();
 				m_recorder.stopRecording();
 				recording = false;
 			}
@@ -1216,6 +1961,31 @@ void MyScene::KeyPressed(keycode_t k)
 		case VKey_X:
 			snap = true;
 			break;
+		case VKey_1:
+			VulkanEngine::get().setPresentPolicy(PresentPolicy::LowestLatency);
+			break;
+		case VKey_2:
+			VulkanEngine::get().setPresentPolicy(PresentPolicy::MaxThroughput);
+			break;
+		case VKey_3:
+			VulkanEngine::get().setPresentPolicy(PresentPolicy::PowerSaving);
+			break;
+		case VKey_M:
+			VulkanEngine::get().printMemoryReport();
+			break;
+		case VKey_B:
+			m_particle_readback_requested = true;
+			break;
+		case VKey_I:
+			VulkanEngine::get().getDispatch().printCallStatistics();
+			if(m_sim_time_ms > 0.0)
+			{
+				std::cout << "Particle simulation: " << m_sim_time_ms << " ms, "
+					<< m_particle_count / (m_sim_time_ms * 1e3) << " Mparticles/s" << '\n';
+			}
+			std::cout << "Particles settled: " << m_settled_count << ", visible: " << m_visible_count << ", culled: "
+				<< m_culled_count << " of " << m_particle_count << '\n';
+			break;
 		default:
 		break;
 	}
@@ -17,6 +17,17 @@ class MyScene : public Scene, public InputManager
 public:
 	MyScene();
 	~MyScene();
+	
+	/*Device features the scene relies on, requested before the engine creates the device*/
+	static VkPhysicalDeviceFeatures getRequiredFeatures();
+	/*Storage format of the particle state, has to match the PARTICLE_FORMAT the shaders were compiled with*/
+	static void setParticleFormat(ParticleFormat format);
+	static ParticleFormat getParticleFormat();
+	/*Initial particle positions are a function of the seed alone, generated by seed.comp in the first
+	frame or, with on_host, in parallel on the host and uploaded*/
+	static void setParticleSeed(uint32_t seed, bool on_host);
+	/*Number of particles, independent of the image, 0 is one per pixel*/
+	static void setParticleCount(uint32_t count);
 
 	virtual InputManager& getInputManager() override;
 	virtual Timer& getTimer() override;
@@ -42,47 +53,85 @@ private:
 
 	void initSynchronizationObjects();
 	void destroySynchronizationObjects();
+	void waitForFrames();
 	
 	void destroyImage();
 	
 	void initCommandBuffers();
 	void initImage();
 	void initSampler();
+	void initRenderPass();
 	void initRenderTargets();
+	void destroyRenderTargets();
 	void initGraphicsPipeline();
+	void initComputePipeline();
+	void destroyComputePipeline();
 	void initRecordImages();
-	void initVertexBuffer();
+	void initParticleBuffers();
+	/*created on the first debug readback*/
+	void initParticleReadback();
+	void initDescriptorSetLayout();
 	void initDescriptorSets();
 	
-	void recordFrame(uint32_t);
+	void recordFrame(uint64_t readback, const Allocation& mem);
 	
 	/*---Surface Independent---*/
 	VkCommandPool m_command_pool = VK_NULL_HANDLE;
-	std::vector<VkCommandBuffer> m_command_buffers;
 	
-	std::vector<VkFence> m_fences;
-	std::vector<VkSemaphore> m_semaphores;
+	std::vector<FrameContext> m_frames;
+	uint64_t m_frame_index = 0;
+	
+	/*fence of the frame that last rendered to each swapchain image*/
+	std::vector<VkFence> m_image_fences;
 	
 	VkQueue m_queue = VK_NULL_HANDLE;
 	
 	std::vector<RecordImage> m_record_images;
 	
-	VkBuffer m_vertex_buffer = VK_NULL_HANDLE;
-	VkBufferView m_vertex_buffer_view = VK_NULL_HANDLE;
-	VkDeviceMemory m_vertex_buffer_memory = VK_NULL_HANDLE;
+	/*Particles are split in chunks that are simulated and drawn one after another, see ParticleChunk*/
+	std::vector<ParticleChunk> m_chunks;
+	uint32_t m_particle_count = 0;
+	/*the grid the particles settle in, see ParticleGrid*/
+	glm::uvec2 m_particle_grid;
+	/*host visible copy of the particle state, only for the debug readback (B key)*/
+	ParticleBuffer m_particle_readback;
+	bool m_particle_readback_requested = false;
+	bool m_particle_readback_pending = false;
+	
+	/*host visible, the active, visible and culled count of every chunk in every frame slot, see ParticleCounts*/
+	ParticleBuffer m_particle_counts;
+	bool m_active_reset_pending = false;
+	uint32_t m_settled_count = 0;
+	uint32_t m_visible_count = 0;
+	uint32_t m_culled_count = 0;
 	
 	VkSampler m_sampler = VK_NULL_HANDLE;
-	VkDeviceMemory m_image_memory = VK_NULL_HANDLE;
+	Allocation m_image_memory;
 	VkImage m_image = VK_NULL_HANDLE;
 	VkImageView m_image_view = VK_NULL_HANDLE;
 	
 	VkDescriptorSetLayout m_descriptor_set_layout = VK_NULL_HANDLE;
 	VkDescriptorPool m_descriptor_pool = VK_NULL_HANDLE;
-	VkDescriptorSet m_descriptor_set = VK_NULL_HANDLE;
+	
+	/*particle simulation, dispatched ahead of the draw every frame*/
+	VkPipelineLayout m_compute_pipeline_layout = VK_NULL_HANDLE;
+	VkPipeline m_compute_pipeline = VK_NULL_HANDLE;
+	uint32_t m_sim_group_size = sim_group_size;
+	/*writes the initial positions and the targets of every chunk, same layout as the simulation*/
+	VkPipeline m_seed_pipeline = VK_NULL_HANDLE;
+	/*appends settled particles the cursor reaches to the step's list*/
+	VkPipeline m_wake_pipeline = VK_NULL_HANDLE;
+	bool m_seed_pending = false;
+	
+	/*two timestamps around the dispatch per frame slot, VK_NULL_HANDLE without timestamp support*/
+	VkQueryPool m_sim_queries = VK_NULL_HANDLE;
+	/*smoothed GPU time of the simulation*/
+	double m_sim_time_ms = 0.0;
 	
 	/*---Surface Dependent---*/
 	
 	VkRenderPass m_render_pass = VK_NULL_HANDLE;
+	VkFormat m_render_pass_format = VK_FORMAT_UNDEFINED;
 	std::vector<RenderTarget> m_render_targets;
 	
 	VkPipelineLayout m_pipeline_layout;
@@ -93,6 +142,8 @@ private:
 	/*---Other---*/
 	Timer m_timer;
 	VulkanRecorder m_recorder;
+	/*latest frame handed to the encoder, the next one runs after it*/
+	JobHandle m_record_job;
 };
 
 #endif //MYSCENE_H
\ No newline at end of file
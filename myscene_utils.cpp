@@ -2,10 +2,178 @@
 
 #include "engine.h"
 
+#include <cmath>
+#include <algorithm>
+
+const char* ParticleFormatToString(ParticleFormat format)
+{
+	switch(format)
+	{
+		case ParticleFormat::AoS: return "aos";
+		case ParticleFormat::SoA: return "soa";
+		case ParticleFormat::Q16: return "q16";
+		default: return "unknown";
+	}
+}
+
+VkDeviceSize ParticleSize(ParticleFormat format)
+{
+	switch(format)
+	{
+		case ParticleFormat::SoA: return 3 * sizeof(float);
+		case ParticleFormat::Q16: return 4 * sizeof(uint16_t);
+		default: return sizeof(Vertex);
+	}
+}
+
+uint32_t ParticleTexels(ParticleFormat format)
+{
+	return format == ParticleFormat::SoA ? 3 : 1;
+}
+
+VkFormat ParticleViewFormat(ParticleFormat format)
+{
+	switch(format)
+	{
+		case ParticleFormat::SoA: return VK_FORMAT_R32_SFLOAT;
+		case ParticleFormat::Q16: return VK_FORMAT_R16G16B16A16_UINT;
+		default: return VK_FORMAT_R32G32B32A32_SFLOAT;
+	}
+}
+
+/*[-bound, bound] to [1, 2^21 - 1], the same rounding as quantize() in particle_format.glsl*/
+constexpr const float particle_levels = 1048575.0f;
+
+static uint64_t Quantize(float v, float bound)
+{
+	float n = std::min(std::max(v / bound, -1.0f), 1.0f);
+	return (uint64_t)(std::round(n * particle_levels) + (particle_levels + 1.0f));
+}
+
+static float Dequantize(uint64_t q, float bound)
+{
+	return ((float)q - (particle_levels + 1.0f)) / particle_levels * bound;
+}
+
+float ParticleEpsilon(ParticleFormat format)
+{
+	/*the quantized format only gets within a quantization step of the destination*/
+	if(format == ParticleFormat::Q16)
+		return std::max({x_bound, y_bound, z_bound}) / particle_levels;
+	
+	return 0.001f;
+}
+
+/*PCG hash, Jarzynski and Olano, "Hash Functions for GPU Rendering"*/
+static uint32_t Pcg(uint32_t v)
+{
+	uint32_t state = v * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+/*[-1, 1) from the top 24 bits, exact in single precision*/
+static float SignedUnit(uint32_t h)
+{
+	return (float)(h >> 8u) * (2.0f / 16777216.0f) - 1.0f;
+}
+
+glm::vec3 SeedParticle(uint32_t seed, uint32_t i)
+{
+	uint32_t key = Pcg(seed);
+	
+	return glm::vec3(SignedUnit(Pcg(key + 3u*i)) * x_bound, SignedUnit(Pcg(key + 3u*i + 1u)) * y_bound, SignedUnit(Pcg(key + 3u*i + 2u)) * z_bound);
+}
+
+glm::uvec2 ParticleGrid(uint32_t count, uint32_t res_x, uint32_t res_y)
+{
+	uint32_t cols = (uint32_t)std::lround(std::sqrt((double)count * res_x / res_y));
+	cols = std::min(std::max(cols, 1u), std::max(count, 1u));
+	
+	return glm::uvec2(cols, (count + cols - 1) / cols);
+}
+
+uint32_t ParticleTarget(glm::uvec2 grid, uint32_t i)
+{
+	/*integer rounding, exact and the same in the shader*/
+	uint32_t x = ((i % grid.x) * 65535u + grid.x / 2u) / grid.x;
+	uint32_t y = ((i / grid.x) * 65535u + grid.y / 2u) / grid.y;
+	
+	return x | (y << 16);
+}
+
+glm::vec3 TargetPosition(uint32_t target, uint32_t res_x, uint32_t res_y)
+{
+	float u = (float)(target & 0xffff) / 65535.0f;
+	float v = (float)(target >> 16) / 65535.0f;
+	
+	return glm::vec3((u - 0.5f) * res_x, (0.5f - v) * res_y, 0.0f);
+}
+
+uint32_t SimGroupSize(const VkPhysicalDeviceLimits& limits)
+{
+	return std::min({sim_group_size, limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations});
+}
+
+void StoreParticle(ParticleFormat format, void* buffer, uint32_t count, uint32_t i, const glm::vec3& pos)
+{
+	switch(format)
+	{
+		case ParticleFormat::SoA:
+		{
+			float* f = (float*)buffer;
+			f[i] = pos.x;
+			f[count + i] = pos.y;
+			f[2 * count + i] = pos.z;
+			break;
+		}
+		case ParticleFormat::Q16:
+		{
+			/*x in bits 0-20, y in 21-41, z in 42-62, as packParticle() in particle_format.glsl*/
+			uint64_t packed = Quantize(pos.x, x_bound) | (Quantize(pos.y, y_bound) << 21) | (Quantize(pos.z, z_bound) << 42);
+			uint16_t* q = (uint16_t*)buffer + 4 * i;
+			for(uint32_t c = 0; c < 4; c++)
+				q[c] = (uint16_t)(packed >> (16 * c));
+			break;
+		}
+		default:
+			((Vertex*)buffer)[i].pos = pos;
+			break;
+	}
+}
+
+glm::vec3 LoadParticle(ParticleFormat format, const void* buffer, uint32_t count, uint32_t i)
+{
+	switch(format)
+	{
+		case ParticleFormat::SoA:
+		{
+			const float* f = (const float*)buffer;
+			return glm::vec3(f[i], f[count + i], f[2 * count + i]);
+		}
+		case ParticleFormat::Q16:
+		{
+			const uint16_t* q = (const uint16_t*)buffer + 4 * i;
+			uint64_t packed = 0;
+			for(uint32_t c = 0; c < 4; c++)
+				packed |= (uint64_t)q[c] << (16 * c);
+			return glm::vec3(Dequantize(packed & 0x1FFFFF, x_bound), Dequantize((packed >> 21) & 0x1FFFFF, y_bound), Dequantize((packed >> 42) & 0x1FFFFF, z_bound));
+		}
+		default:
+			return ((const Vertex*)buffer)[i].pos;
+	}
+}
+
 void RecordImage::destroy()
 {
 	VkDevice d = VulkanEngine::get().getDevice();
 	
+	VulkanEngine::get().getJobs().wait(host_job);
+	host_job.reset();
+	
+	VulkanEngine::get().getTransfer().wait(readback);
+	readback = 0;
+	
 	if(img != VK_NULL_HANDLE)
 	{
 		vkDestroyImage(d, img, VK_NULL_HANDLE);
@@ -18,17 +186,8 @@ void RecordImage::destroy()
 		img1 = VK_NULL_HANDLE;
 	}
 	
-	if(img_mem1 != VK_NULL_HANDLE)
-	{
-		vkFreeMemory(d, img_mem1, VK_NULL_HANDLE);
-		img_mem1 = VK_NULL_HANDLE;
-	}
-	
-	if(img_mem != VK_NULL_HANDLE)
-	{
-		vkFreeMemory(d, img_mem, VK_NULL_HANDLE);
-		img_mem = VK_NULL_HANDLE;
-	}
+	VulkanEngine::get().getAllocator().free(img_mem1);
+	VulkanEngine::get().getAllocator().free(img_mem);
 }
 
 void VulkanImage::destroy()
@@ -47,11 +206,45 @@ void VulkanImage::destroy()
 		img_view = VK_NULL_HANDLE;
 	}
 	
-	if(mem != VK_NULL_HANDLE)
+	VulkanEngine::get().getAllocator().free(mem);
+}
+
+void ParticleBuffer::destroy()
+{
+	VkDevice d = VulkanEngine::get().getDevice();
+	
+	if(view != VK_NULL_HANDLE)
+	{
+		vkDestroyBufferView(d, view, VK_NULL_HANDLE);
+		view = VK_NULL_HANDLE;
+	}
+	
+	if(buffer != VK_NULL_HANDLE)
 	{
-		vkFreeMemory(d, mem, VK_NULL_HANDLE);
-		mem = VK_NULL_HANDLE;
+		vkDestroyBuffer(d, buffer, VK_NULL_HANDLE);
+		buffer = VK_NULL_HANDLE;
 	}
+	
+	VulkanEngine::get().getAllocator().free(mem);
+}
+
+void ParticleChunk::destroy()
+{
+	for(auto& p : positions)
+		p.destroy();
+	
+	targets.destroy();
+	states.destroy();
+	
+	for(auto& l : active_lists)
+		l.destroy();
+	
+	for(auto& l : visible_lists)
+		l.destroy();
+	
+	/*the sets go with the descriptor pool*/
+	for(auto& s : descriptor_sets)
+		s = VK_NULL_HANDLE;
 }
 
 void RenderTarget::destroy()
@@ -5,20 +5,158 @@
 #include "vulkan_math.h"
 #include <vector>
 
+#include "allocator.h"
+#include "jobs.h"
+
+constexpr const float min_speed = 50.0f;
+constexpr const float mid_speed = 100.0f;
+constexpr const float top_speed = 200.0f;
+
+/*particles start inside this box, the quantized format covers it*/
+constexpr const float x_bound = 5000.0f;
+constexpr const float y_bound = 5000.0f;
+constexpr const float z_bound = 5000.0f;
+
+/*particles per simulation workgroup, a multiple of every common subgroup size, clamped to the device limits*/
+constexpr const uint32_t sim_group_size = 256;
+
+/*most particles in one chunk, further clamped to the device limits, see MyScene::initParticleBuffers*/
+constexpr const uint32_t particle_chunk_size = 1 << 22;
+
+/*Push constants shared by every draw*/
+struct s_constants
+{
+	glm::mat4x4 vp;
+	float dt;
+	float particle_speed = min_speed;
+	uint32_t res_x = 960;
+	uint32_t res_y = 955;
+	glm::vec3 eyeW;
+	/*the chunk being simulated or drawn, set per chunk*/
+	uint32_t first = 0;
+	glm::vec3 curDirNW;
+	uint32_t count = 0;
+};
+
 struct Vertex
 {
 	glm::vec3 pos;
 	float pad;
 };
 
+/*particle state buffers the simulation alternates between, so a step never reads what it writes*/
+constexpr const uint32_t particle_buffer_count = 2;
+
+/*How particle positions are stored, the shaders are compiled for one of them with -DPARTICLE_FORMAT=<value>,
+see shader_code/particle_format.glsl which mirrors the packing below*/
+enum class ParticleFormat : uint32_t
+{
+	AoS,	//RGBA32F per particle, 16 bytes
+	SoA,	//R32F arrays of x, y and z, 12 bytes
+	Q16		//RGBA16UI, xyz quantized to 21 bits against the bounds and packed into the 16 bit channels, 8 bytes
+};
+/*Q16 rounds every store to a step of x_bound / (2^20 - 1), about 0.005 units. Each simulation step moves a
+particle by at least one such step, so it keeps moving and settles at any frame rate.*/
+
+const char* ParticleFormatToString(ParticleFormat format);
+/*bytes per particle*/
+VkDeviceSize ParticleSize(ParticleFormat format);
+/*texel buffer elements per particle*/
+uint32_t ParticleTexels(ParticleFormat format);
+/*format of the storage texel buffer views*/
+VkFormat ParticleViewFormat(ParticleFormat format);
+/*distance within which a stored particle is at its destination, PARTICLE_EPSILON in particle_format.glsl*/
+float ParticleEpsilon(ParticleFormat format);
+/*pack and unpack particle i of count in a buffer of the given format*/
+void StoreParticle(ParticleFormat format, void* buffer, uint32_t count, uint32_t i, const glm::vec3& pos);
+glm::vec3 LoadParticle(ParticleFormat format, const void* buffer, uint32_t count, uint32_t i);
+
+/*Initial position of particle i, a counter based PCG hash of seed and i, so any range can be
+generated independently and the result is the same on the host and in shader_code/seed.comp*/
+glm::vec3 SeedParticle(uint32_t seed, uint32_t i);
+
+/*Columns and rows of the grid particles settle in, with the aspect ratio of the image.
+It is the image's own pixel grid when there is a particle per pixel.*/
+glm::uvec2 ParticleGrid(uint32_t count, uint32_t res_x, uint32_t res_y);
+/*Texture coordinate of the cell particle i settles in, two 16 bit unorms with x in the low half
+(unpackUnorm2x16), shader_code/seed.comp computes the same*/
+uint32_t ParticleTarget(glm::uvec2 grid, uint32_t i);
+/*where a particle with the given target settles, the image spans res_x by res_y around the origin of the z = 0 plane*/
+glm::vec3 TargetPosition(uint32_t target, uint32_t res_x, uint32_t res_y);
+
+/*workgroup size of the particle passes within the device limits*/
+uint32_t SimGroupSize(const VkPhysicalDeviceLimits& limits);
+
+struct ParticleBuffer
+{
+	void destroy();
+	
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkBufferView view = VK_NULL_HANDLE;
+	Allocation mem;
+};
+
+/*Header of an active particle list, shader_code/active_list.glsl, followed by count particle indices.
+groups_x..z are the simulation's VkDispatchIndirectCommand.*/
+struct ActiveListHeader
+{
+	uint32_t groups_x;
+	uint32_t groups_y;
+	uint32_t groups_z;
+	uint32_t count;
+};
+
+/*Header of a visible particle list, shader_code/visible_list.glsl, followed by draw.vertexCount particle indices.
+draw is the indirect draw, culled counts the particles the frustum test rejected.*/
+struct VisibleListHeader
+{
+	VkDrawIndirectCommand draw;
+	uint32_t culled;
+};
+
+/*A range of particles with buffers of its own, so no buffer outgrows the device limits.
+Chunks are simulated independently and drawn one after another.*/
+struct ParticleChunk
+{
+	void destroy();
+	
+	uint32_t first = 0;
+	uint32_t count = 0;
+	/*positions, alternating between simulation steps*/
+	ParticleBuffer positions[particle_buffer_count];
+	/*where each particle settles, see ParticleTarget*/
+	ParticleBuffer targets;
+	/*Only moving particles are simulated. Per particle state, see shader_code/active_list.glsl, and two
+	active lists, each step dispatches over one and appends the particles still moving to the other.*/
+	ParticleBuffer states;
+	ParticleBuffer active_lists[particle_buffer_count];
+	/*Only particles inside the frustum are drawn, the lists alternate with the positions and are
+	filled by the step writing them. Their header is the indirect draw.*/
+	ParticleBuffer visible_lists[particle_buffer_count];
+	/*one per simulation step, see MyScene::initDescriptorSets*/
+	VkDescriptorSet descriptor_sets[particle_buffer_count] = {};
+};
+
+/*One frame's particle counts of a chunk, copied out of the list headers*/
+struct ParticleCounts
+{
+	uint32_t active;
+	uint32_t visible;
+	uint32_t culled;
+};
+
 struct RecordImage
 {
 	void destroy();
 	
-	VkDeviceMemory img_mem = VK_NULL_HANDLE;
+	Allocation img_mem;
 	VkImage img = VK_NULL_HANDLE;
-	VkDeviceMemory img_mem1 = VK_NULL_HANDLE;
+	Allocation img_mem1;
 	VkImage img1 = VK_NULL_HANDLE;
+	/*transfer batch copying img to img1, the host may read img_mem1 once it completed*/
+	uint64_t readback = 0;
+	/*last job reading img_mem1 (snapshot, encoding), img1 is not written again before it finished*/
+	JobHandle host_job;
 };
 
 struct VulkanImage
@@ -27,7 +165,25 @@ struct VulkanImage
 	
 	VkImage img;
 	VkImageView img_view;
-	VkDeviceMemory mem;
+	Allocation mem;
+};
+
+/*Everything a single frame in flight owns, indexed by frame number rather than by swapchain image*/
+struct FrameContext
+{
+	VkCommandBuffer cmd_buf = VK_NULL_HANDLE;
+	VkFence fence = VK_NULL_HANDLE;
+	VkSemaphore sem_acquire = VK_NULL_HANDLE;
+	VkSemaphore sem_submit = VK_NULL_HANDLE;
+	/*signalled for the transfer queue when the frame is read back for recording*/
+	VkSemaphore sem_readback = VK_NULL_HANDLE;
+	s_constants constants;
+	/*the frame wrote its simulation timestamps, they can be read once its fence is signalled*/
+	bool sim_timed = false;
+	/*the frame copied the particle state to the debug readback buffer*/
+	bool particle_readback = false;
+	/*the frame copied the number of particles it simulated and drew to its slot of the particle counts*/
+	bool particles_counted = false;
 };
 
 struct RenderTarget
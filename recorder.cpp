@@ -1,5 +1,7 @@
 #include "recorder.h"
 #include <iostream>
+#include <algorithm>
+#include <atomic>
 
 using namespace std;
 
@@ -71,6 +73,12 @@ bool VulkanRecorder::close()
 		m_sws = NULL;
 	}
 	
+	for(auto& band : m_bands)
+	{
+		sws_freeContext(band.sws);
+	}
+	m_bands.clear();
+	
 	memset((char*)&m_pic_raw, 0, sizeof(m_pic_raw));
 	
 	if(m_file)
@@ -114,6 +122,11 @@ bool VulkanRecorder::open(std::string filename)
 		return false;
 	}
 	
+	if(!createBands())
+	{
+		ErrorMessage("Cannot create SWS band contexts, converting in one piece");
+	}
+	
 	m_file = fopen(filename.c_str(), "w+b");
 	if(!m_file)
 	{
@@ -157,6 +170,44 @@ bool VulkanRecorder::open(std::string filename)
 	return false;
 }
 
+bool VulkanRecorder::createBands()
+{
+	/*bands map to the same output rows only without vertical scaling*/
+	if(!m_jobs || m_jobs->getWorkerCount() == 0 || m_height_in != m_height_out)
+		return true;
+	
+	/*at least 64 rows per band, kept even for the half height chroma planes*/
+	int band_count = std::min<int>(m_jobs->getWorkerCount() + 1, m_height_out / 64);
+	if(band_count < 2)
+		return true;
+	
+	int rows = ((m_height_out / band_count) + 1) & ~1;
+	
+	for(int y = 0; y < m_height_out; y += rows)
+	{
+		Band band;
+		band.y = y;
+		band.rows = std::min(rows, m_height_out - y);
+		band.sws = sws_getContext(m_width_in, band.rows, m_pixel_format_in,
+						m_width_out, band.rows, m_pixel_format_out,
+						SWS_FAST_BILINEAR, NULL, NULL, NULL);
+		
+		if(!band.sws)
+		{
+			for(auto& b : m_bands)
+			{
+				sws_freeContext(b.sws);
+			}
+			m_bands.clear();
+			return false;
+		}
+		
+		m_bands.push_back(band);
+	}
+	
+	return true;
+}
+
 bool VulkanRecorder::encode(uint8_t* pixels)
 {
 	if(!m_sws)
@@ -174,7 +225,34 @@ bool VulkanRecorder::encode(uint8_t* pixels)
 	}
 	
 	/*convert to I420 for x264*/
-	int h = sws_scale(m_sws, m_pic_raw.data, m_pic_raw.linesize, 0, m_height_in, m_pic_in.img.plane, m_pic_in.img.i_stride);
+	int h = 0;
+	
+	if(m_bands.empty())
+	{
+		h = sws_scale(m_sws, m_pic_raw.data, m_pic_raw.linesize, 0, m_height_in, m_pic_in.img.plane, m_pic_in.img.i_stride);
+	}
+	else
+	{
+		std::atomic<int> rows{0};
+		
+		m_jobs->parallelFor(m_bands.size(), 1, [&](uint32_t begin, uint32_t end)
+		{
+			for(uint32_t b = begin; b < end; b++)
+			{
+				const Band& band = m_bands[b];
+				
+				const uint8_t* src[] = {m_pic_raw.data[0] + band.y * m_pic_raw.linesize[0]};
+				uint8_t* dst[] = {
+					m_pic_in.img.plane[0] + band.y * m_pic_in.img.i_stride[0],
+					m_pic_in.img.plane[1] + band.y / 2 * m_pic_in.img.i_stride[1],
+					m_pic_in.img.plane[2] + band.y / 2 * m_pic_in.img.i_stride[2]};
+				
+				rows += sws_scale(band.sws, src, m_pic_raw.linesize, 0, band.rows, dst, m_pic_in.img.i_stride);
+			}
+		});
+		
+		h = rows;
+	}
 	
 	if(h != m_height_out) {
 		ErrorMessage("scale failed");
@@ -196,6 +274,11 @@ bool VulkanRecorder::encode(uint8_t* pixels)
 	return true;
 }
 
+void VulkanRecorder::setJobSystem(JobSystem* jobs)
+{
+	m_jobs = jobs;
+}
+
 void VulkanRecorder::startRecording(std::string filename, uint16_t in_res_x, uint16_t in_res_y, uint16_t out_res_x, uint16_t out_res_y, uint8_t fps)
 {
 	/*zero out picture*/
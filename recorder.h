@@ -3,6 +3,9 @@
 
 #include <string>
 #include <cstdint>
+#include <vector>
+
+#include "jobs.h"
 
 extern "C"{
 #include <x264.h>
@@ -16,12 +19,15 @@ public:
 	VulkanRecorder() = default;
 	~VulkanRecorder() = default;
 	
+	/*Colour conversion runs in horizontal bands on the job system when set*/
+	void setJobSystem(JobSystem* jobs);
 	void startRecording(std::string filename, uint16_t in_res_x, uint16_t in_res_y, uint16_t out_res_x, uint16_t out_res_y, uint8_t fps);
 	void nextFrame(uint8_t* rgba);
 	void stopRecording();
 	
 private:
 	bool open(std::string);
+	bool createBands();
 	bool encode(uint8_t*);
 	bool close();
 	void setParams();
@@ -49,6 +55,16 @@ private:
 	int m_pts = 0;
 	SwsContext* m_sws = NULL;
 	FILE* m_file = NULL;
+	
+	/*colour conversion bands, each with its own context since a context converts slices in order only*/
+	struct Band
+	{
+		SwsContext* sws;
+		int y;
+		int rows;
+	};
+	JobSystem* m_jobs = NULL;
+	std::vector<Band> m_bands;
 };
 
 #endif //RECORDER_H
\ No newline at end of file
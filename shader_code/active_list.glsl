@@ -0,0 +1,40 @@
+//Compacted list of the particles the simulation still moves, laid out as ActiveList in myscene_utils.h.
+//The header is the VkDispatchIndirectCommand of the simulation followed by the particle count.
+
+#define PARTICLE_NEW 0u
+#define PARTICLE_ACTIVE 1u
+#define PARTICLE_SETTLED 2u
+
+#define ACTIVE_LIST_BLOCK \
+	uint groups_x; \
+	uint groups_y; \
+	uint groups_z; \
+	uint count; \
+	uint index[];
+
+//every workgroup's first particle adds the workgroup, groups_x stays the count rounded up to whole workgroups
+#define ACTIVE_APPEND(list, id) \
+	{ \
+		uint slot = atomicAdd(list.count, 1u); \
+		list.index[slot] = id; \
+		if(slot % gl_WorkGroupSize.x == 0u) \
+			atomicAdd(list.groups_x, 1u); \
+	}
+
+//where a particle settles, its target is a texture coordinate and the image spans res_x by res_y
+//around the origin of the z = 0 plane, TargetPosition in myscene_utils.cpp
+vec3 particleDest(uint target, uint res_x, uint res_y)
+{
+	vec2 uv = unpackUnorm2x16(target);
+	return vec3((uv.x - 0.5f) * float(res_x), (0.5f - uv.y) * float(res_y), 0);
+}
+
+//offset that keeps a particle out of the cursor ray, zero when it is far enough away
+vec3 cursorPush(vec3 pos, vec3 eye, vec3 dir)
+{
+	vec3 eye_to_ver = eye - pos;
+	vec3 proj = dot(eye_to_ver, dir) * dir;
+	vec3 v = eye_to_ver - proj;
+	float lv = length(v);
+	return lv <= 100.0f ? -v / lv * 100.0f : vec3(0);
+}
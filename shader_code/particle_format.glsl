@@ -0,0 +1,92 @@
+//Particle storage formats, PARTICLE_FORMAT and PARTICLE_BOUND_X/Y/Z (x_bound, y_bound, z_bound) are defined
+//on the glslangValidator command line.
+//Values and packing match ParticleFormat and StoreParticle in myscene_utils.h/.cpp.
+//Included after the push constants, buffers hold the pc.count particles of one chunk.
+
+#define PARTICLE_FORMAT_AOS 0
+#define PARTICLE_FORMAT_SOA 1
+#define PARTICLE_FORMAT_Q16 2
+
+#ifndef PARTICLE_FORMAT
+#define PARTICLE_FORMAT PARTICLE_FORMAT_AOS
+#endif
+
+#define PARTICLE_COUNT int(pc.count)
+
+//the box particles start in, no default so a shader built without the host's bounds does not compile
+const vec3 particle_bound = vec3(PARTICLE_BOUND_X, PARTICLE_BOUND_Y, PARTICLE_BOUND_Z);
+
+#if PARTICLE_FORMAT == PARTICLE_FORMAT_AOS
+
+//16 bytes, xyz and padding
+#define PARTICLE_LAYOUT rgba32f
+#define PARTICLE_BUFFER imageBuffer
+
+#define PARTICLE_LOAD(buf, i) imageLoad(buf, i).xyz
+#define PARTICLE_STORE(buf, i, p) imageStore(buf, i, vec4(p, 0))
+
+//distance within which a stored particle is at its destination
+#define PARTICLE_EPSILON 0.001f
+//shortest move a step makes, a stored position can represent any move
+#define PARTICLE_MIN_MOVE 0.0f
+
+#elif PARTICLE_FORMAT == PARTICLE_FORMAT_SOA
+
+//12 bytes, arrays of x, y and z one after another
+#define PARTICLE_LAYOUT r32f
+#define PARTICLE_BUFFER imageBuffer
+
+#define PARTICLE_LOAD(buf, i) vec3(imageLoad(buf, i).x, imageLoad(buf, PARTICLE_COUNT + i).x, imageLoad(buf, 2*PARTICLE_COUNT + i).x)
+#define PARTICLE_STORE(buf, i, p) \
+	imageStore(buf, i, vec4(p.x)); \
+	imageStore(buf, PARTICLE_COUNT + i, vec4(p.y)); \
+	imageStore(buf, 2*PARTICLE_COUNT + i, vec4(p.z))
+
+#define PARTICLE_EPSILON 0.001f
+#define PARTICLE_MIN_MOVE 0.0f
+
+#elif PARTICLE_FORMAT == PARTICLE_FORMAT_Q16
+
+//8 bytes, xyz quantized to 21 bits each against the bounds particles start in (x_bound, y_bound, z_bound),
+//packed into the four 16 bit channels: x in bits 0-20, y in 21-41, z in 42-62
+#define PARTICLE_LAYOUT rgba16ui
+#define PARTICLE_BUFFER uimageBuffer
+
+const float particle_levels = 1048575.0f; //2^20 - 1 steps on either side of 0
+const uint particle_mask = 0x1FFFFFu;
+
+uvec3 quantize(vec3 p)
+{
+	return uvec3(round(clamp(p / particle_bound, -1.0f, 1.0f) * particle_levels) + (particle_levels + 1.0f));
+}
+
+vec3 dequantize(uvec3 q)
+{
+	return (vec3(q) - (particle_levels + 1.0f)) / particle_levels * particle_bound;
+}
+
+uvec4 packParticle(uvec3 q)
+{
+	uint lo = q.x | (q.y << 21);
+	uint hi = (q.y >> 11) | (q.z << 10);
+	return uvec4(lo & 0xFFFFu, lo >> 16, hi & 0xFFFFu, hi >> 16);
+}
+
+uvec3 unpackParticle(uvec4 w)
+{
+	uint lo = w.x | (w.y << 16);
+	uint hi = w.z | (w.w << 16);
+	return uvec3(lo & particle_mask, ((lo >> 21) | (hi << 11)) & particle_mask, (hi >> 10) & particle_mask);
+}
+
+#define PARTICLE_LOAD(buf, i) dequantize(unpackParticle(imageLoad(buf, i)))
+#define PARTICLE_STORE(buf, i, p) imageStore(buf, i, packParticle(quantize(p)))
+
+//a quantization step of the widest axis, about 0.005 units, the stored destination is only that close to the exact one
+#define PARTICLE_EPSILON (max(particle_bound.x, max(particle_bound.y, particle_bound.z)) / particle_levels)
+//Rounding loses a move shorter than half a step on every axis, a particle would stop short of its destination
+//at high frame rates. A step of at least PARTICLE_EPSILON moves its largest axis by a level, and gets closer
+//by more than the rounding of the others takes back, so the particle always reaches PARTICLE_EPSILON and settles.
+#define PARTICLE_MIN_MOVE PARTICLE_EPSILON
+
+#endif
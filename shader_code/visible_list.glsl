@@ -0,0 +1,32 @@
+//Particles inside the view frustum, a VkDrawIndirectCommand and the number of particles culled, followed by
+//vertex_count particle indices, VisibleListHeader in myscene_utils.h.
+//Filled by wake.comp and sim.comp, each particle is tested by exactly one of them, and drawn by vs.vert.
+
+#define VISIBLE_LIST_BLOCK \
+	uint vertex_count; \
+	uint instance_count; \
+	uint first_vertex; \
+	uint first_instance; \
+	uint culled; \
+	uint index[];
+
+#define VISIBLE_APPEND(list, id) \
+	{ \
+		uint slot = atomicAdd(list.vertex_count, 1u); \
+		list.index[slot] = id; \
+	}
+
+//appends the particle if its position is inside the frustum, counts it as culled otherwise
+#define VISIBLE_TEST(list, id, pos, viewProj) \
+	if(inFrustum(pos, viewProj)) \
+		VISIBLE_APPEND(list, id) \
+	else \
+		atomicAdd(list.culled, 1u)
+
+//points are discarded when their vertex is outside the clip volume, the depth range test is
+//the wider -w..w so it holds for either depth convention of the projection
+bool inFrustum(vec3 pos, mat4 viewProj)
+{
+	vec4 clip = vec4(pos, 1.0f) * viewProj;
+	return all(lessThanEqual(abs(clip.xyz), vec3(clip.w)));
+}
@@ -1,6 +1,5 @@
 #version 450
-
-const float delta = 1.0f;
+#extension GL_GOOGLE_include_directive : require
 
 layout(push_constant) uniform pushConstants {
     layout(row_major)mat4x4 viewProj;
@@ -9,55 +8,30 @@ layout(push_constant) uniform pushConstants {
 	uint res_x;
 	uint res_y;
 	vec3 eyePosW;
-	float p0; //padding
+	uint first; //the chunk being simulated or drawn
 	vec3 curDirNW;
+	uint count;
 } pc;
 
-layout(set=0, binding=0, rgba32f) uniform imageBuffer vPos;
+#include "particle_format.glsl"
+#include "visible_list.glsl"
+
+//positions are simulated by sim.comp before the draw, only read here
+layout(set=0, binding=0, PARTICLE_LAYOUT) uniform readonly PARTICLE_BUFFER vPos;
+//drawn indirectly, one vertex per particle the simulation found inside the frustum
+layout(set=0, binding=6, std430) readonly buffer Visible { VISIBLE_LIST_BLOCK } visible;
+//each particle's texture coordinate, also where it settles
+layout(set=0, binding=7, std430) readonly buffer Targets { uint targets[]; };
 
 layout(location=0) out vec2 tex_coord;
 
 void main()
 {
-	float rX = float(pc.res_x);
-	float rY = float(pc.res_y);
-	
-	uvec2 coord = uvec2(gl_VertexIndex % int(pc.res_x), gl_VertexIndex / int(pc.res_x));
-	tex_coord = vec2(float(coord.x) / rX, float(coord.y) / rY);
-	
-	vec3 currPos = imageLoad(vPos, gl_VertexIndex).xyz;
-	vec3 destPos = vec3(-rX/2 + float(coord.x)*delta, rY/2 - float(coord.y)*delta, 0);
-	
-	//vec3 xx = cross(pc.eyePosW - currPos, pc.curDirNW);
-	//float cur_dist = length(xx);
-	//xx = normalize(xx);
-	//if(cur_dist <= 100.0f)
-	//	currPos += xx*100.0f;
-	
-	vec3 eye_to_ver = pc.eyePosW - currPos;
-	vec3 proj = dot(eye_to_ver, pc.curDirNW) * pc.curDirNW;
-	vec3 v = eye_to_ver - proj;
-	float lv = length(v);
-	if(lv <= 100.0f)
-	{
-		v /= lv;
-		currPos -= v*100.0f;
-	}
+	uint id = visible.index[gl_VertexIndex];
 	
-	vec3 dir = destPos - currPos;
-	float dist = length(dir);
+	tex_coord = unpackUnorm2x16(targets[id]);
 	
-	if(dist >= pc.speed*pc.dt)
-	{
-		dir /= dist;
-		currPos +=  dir*pc.speed*pc.dt;
-		imageStore(vPos, gl_VertexIndex, vec4(currPos, 0));
-	}
-	else if (dist >= 0.001)
-	{
-		currPos = destPos;
-		imageStore(vPos, gl_VertexIndex, vec4(currPos, 0));
-	}
+	vec3 currPos = PARTICLE_LOAD(vPos, int(id));
 	
 	gl_Position = vec4(currPos, 1.0f) * pc.viewProj;
 	gl_Position.y *= -1;
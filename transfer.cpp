@@ -0,0 +1,391 @@
+#include "transfer.h"
+#include "debug.h"
+
+bool VulkanTransfer::init(VkDevice device, DeviceDispatch* vk, VulkanAllocator* allocator, VkQueue transfer_queue, uint32_t transfer_family, VkQueue graphics_queue, uint32_t graphics_family)
+{
+	m_device = device;
+	m_vk = vk;
+	m_allocator = allocator;
+	m_queue = transfer_queue;
+	m_family = transfer_family;
+	m_graphics_queue = graphics_queue;
+	m_graphics_family = graphics_family;
+
+	return true;
+}
+
+void VulkanTransfer::destroy()
+{
+	if(m_device == VK_NULL_HANDLE)
+		return;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for(auto batch : m_in_flight)
+	{
+		m_vk->vkWaitForFences(m_device, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+		recycle(batch);
+		m_free.push_back(batch);
+	}
+	m_in_flight.clear();
+
+	/*command buffers are freed along with their pools*/
+	for(auto batch : m_free)
+	{
+		vkDestroyCommandPool(m_device, batch->pool, VK_NULL_HANDLE);
+		vkDestroyCommandPool(m_device, batch->acquire_pool, VK_NULL_HANDLE);
+		vkDestroyFence(m_device, batch->fence, VK_NULL_HANDLE);
+		vkDestroySemaphore(m_device, batch->semaphore, VK_NULL_HANDLE);
+		delete batch;
+	}
+	m_free.clear();
+
+	m_device = VK_NULL_HANDLE;
+}
+
+TransferBatch* VulkanTransfer::begin()
+{
+	collect();
+
+	TransferBatch* batch;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if(!m_free.empty())
+		{
+			batch = m_free.back();
+			m_free.pop_back();
+		}
+		else
+		{
+			batch = new TransferBatch;
+
+			/*a command pool may only be used by one thread at a time, the batch is only recorded by the thread that began it*/
+			VkCommandPoolCreateInfo pool_create_info{};
+			pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			pool_create_info.pNext = NULL;
+			pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+			pool_create_info.queueFamilyIndex = m_family;
+
+			VkResult res = vkCreateCommandPool(m_device, &pool_create_info, VK_NULL_HANDLE, &batch->pool);
+			if(res < 0)
+				ErrorMessage("Error: Failed to create transfer command pool.", res);
+
+			pool_create_info.queueFamilyIndex = m_graphics_family;
+
+			res = vkCreateCommandPool(m_device, &pool_create_info, VK_NULL_HANDLE, &batch->acquire_pool);
+			if(res < 0)
+				ErrorMessage("Error: Failed to create ownership transfer command pool.", res);
+
+			VkCommandBufferAllocateInfo cmd_buf_allocate_info{};
+			cmd_buf_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			cmd_buf_allocate_info.pNext = NULL;
+			cmd_buf_allocate_info.commandPool = batch->pool;
+			cmd_buf_allocate_info.commandBufferCount = 1;
+			cmd_buf_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+			vkAllocateCommandBuffers(m_device, &cmd_buf_allocate_info, &batch->cmd_buf);
+
+			cmd_buf_allocate_info.commandPool = batch->acquire_pool;
+			vkAllocateCommandBuffers(m_device, &cmd_buf_allocate_info, &batch->acquire_cmd_buf);
+
+			VkFenceCreateInfo fence_create_info{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, NULL, 0};
+			VkSemaphoreCreateInfo sem_create_info{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, NULL, 0};
+
+			vkCreateFence(m_device, &fence_create_info, VK_NULL_HANDLE, &batch->fence);
+			vkCreateSemaphore(m_device, &sem_create_info, VK_NULL_HANDLE, &batch->semaphore);
+		}
+	}
+
+	VkCommandBufferBeginInfo begin_info{};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.pNext = NULL;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	begin_info.pInheritanceInfo = NULL;
+
+	m_vk->vkBeginCommandBuffer(batch->cmd_buf, &begin_info);
+
+	return batch;
+}
+
+VkBuffer VulkanTransfer::createStagingBuffer(TransferBatch* batch, VkDeviceSize size, void** mapped)
+{
+	VkBufferCreateInfo buffer_create_info{};
+	buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buffer_create_info.pNext = NULL;
+	buffer_create_info.flags = 0;
+	buffer_create_info.size = size;
+	buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkResult res = vkCreateBuffer(m_device, &buffer_create_info, VK_NULL_HANDLE, &buffer);
+	if(res < 0)
+	{
+		ErrorMessage("Error: Failed to create staging buffer.", res);
+		return VK_NULL_HANDLE;
+	}
+
+	/*coherent, so the host writes need no flush before the submit*/
+	Allocation memory;
+	if(!m_allocator->allocateBuffer(buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, MemoryTag::Staging, memory))
+	{
+		ErrorMessage("Error: Failed to allocate staging buffer memory.");
+		vkDestroyBuffer(m_device, buffer, VK_NULL_HANDLE);
+		return VK_NULL_HANDLE;
+	}
+
+	if(mapped)
+		*mapped = memory.mapped;
+
+	batch->staging_buffers.push_back(buffer);
+	batch->staging_memory.push_back(memory);
+
+	return buffer;
+}
+
+void VulkanTransfer::releaseToGraphics(TransferBatch* batch, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout,
+	VkAccessFlags src_access, VkAccessFlags dst_access, VkPipelineStageFlags dst_stage)
+{
+	VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, NULL, src_access, dst_access,
+		old_layout, new_layout, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, image,
+		{VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS}};
+
+	/*on a shared queue the barrier alone makes the data visible to later submissions*/
+	if(!isDedicated())
+	{
+		m_vk->vkCmdPipelineBarrier(batch->cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage, 0, 0, NULL, 0, NULL, 1, &barrier);
+		return;
+	}
+
+	/*the release only needs the source half, the destination half is the acquire on the graphics queue*/
+	barrier.srcQueueFamilyIndex = m_family;
+	barrier.dstQueueFamilyIndex = m_graphics_family;
+	barrier.dstAccessMask = 0;
+	m_vk->vkCmdPipelineBarrier(batch->cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = dst_access;
+	batch->image_acquires.push_back(barrier);
+	batch->acquire_stages |= dst_stage;
+}
+
+void VulkanTransfer::releaseToGraphics(TransferBatch* batch, VkBuffer buffer, VkAccessFlags src_access, VkAccessFlags dst_access, VkPipelineStageFlags dst_stage)
+{
+	VkBufferMemoryBarrier barrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER, NULL, src_access, dst_access,
+		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, buffer, 0, VK_WHOLE_SIZE};
+
+	if(!isDedicated())
+	{
+		m_vk->vkCmdPipelineBarrier(batch->cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage, 0, 0, NULL, 1, &barrier, 0, NULL);
+		return;
+	}
+
+	barrier.srcQueueFamilyIndex = m_family;
+	barrier.dstQueueFamilyIndex = m_graphics_family;
+	barrier.dstAccessMask = 0;
+	m_vk->vkCmdPipelineBarrier(batch->cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 1, &barrier, 0, NULL);
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = dst_access;
+	batch->buffer_acquires.push_back(barrier);
+	batch->acquire_stages |= dst_stage;
+}
+
+void VulkanTransfer::releaseFromGraphics(VkCommandBuffer graphics_cmd_buf, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout,
+	VkAccessFlags src_access, VkPipelineStageFlags src_stage)
+{
+	VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, NULL, src_access, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+		old_layout, new_layout, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, image,
+		{VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS}};
+
+	if(!isDedicated())
+	{
+		m_vk->vkCmdPipelineBarrier(graphics_cmd_buf, src_stage, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+		return;
+	}
+
+	barrier.srcQueueFamilyIndex = m_graphics_family;
+	barrier.dstQueueFamilyIndex = m_family;
+	barrier.dstAccessMask = 0;
+	m_vk->vkCmdPipelineBarrier(graphics_cmd_buf, src_stage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+void VulkanTransfer::acquireFromGraphics(TransferBatch* batch, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout, VkAccessFlags dst_access)
+{
+	/*the release on the graphics queue already made the transition*/
+	if(!isDedicated())
+		return;
+
+	/*layouts have to match the release, the transition happens once, between the two*/
+	VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, NULL, 0, dst_access,
+		old_layout, new_layout, m_graphics_family, m_family, image,
+		{VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS}};
+
+	m_vk->vkCmdPipelineBarrier(batch->cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+uint64_t VulkanTransfer::submit(TransferBatch* batch, VkSemaphore wait, VkPipelineStageFlags wait_stage)
+{
+	m_vk->vkEndCommandBuffer(batch->cmd_buf);
+
+	const bool acquire = !batch->image_acquires.empty() || !batch->buffer_acquires.empty();
+
+	VkSubmitInfo submit_info{};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.pNext = NULL;
+	submit_info.waitSemaphoreCount = wait != VK_NULL_HANDLE ? 1 : 0;
+	submit_info.pWaitSemaphores = &wait;
+	submit_info.pWaitDstStageMask = &wait_stage;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &batch->cmd_buf;
+	submit_info.signalSemaphoreCount = acquire ? 1 : 0;
+	submit_info.pSignalSemaphores = &batch->semaphore;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	/*the fence goes with the last submission, so a completed batch is visible to the graphics queue as well*/
+	VkResult res = m_vk->vkQueueSubmit(m_queue, 1, &submit_info, acquire ? VK_NULL_HANDLE : batch->fence);
+	if(res < 0)
+		ErrorMessage("Error: Failed to submit transfer batch.", res);
+
+	if(acquire)
+	{
+		VkCommandBufferBeginInfo begin_info{};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.pNext = NULL;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		begin_info.pInheritanceInfo = NULL;
+
+		m_vk->vkBeginCommandBuffer(batch->acquire_cmd_buf, &begin_info);
+		m_vk->vkCmdPipelineBarrier(batch->acquire_cmd_buf, batch->acquire_stages, batch->acquire_stages, 0, 0, NULL,
+			batch->buffer_acquires.size(), batch->buffer_acquires.data(), batch->image_acquires.size(), batch->image_acquires.data());
+		m_vk->vkEndCommandBuffer(batch->acquire_cmd_buf);
+
+		VkSubmitInfo acquire_info{};
+		acquire_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		acquire_info.pNext = NULL;
+		acquire_info.waitSemaphoreCount = 1;
+		acquire_info.pWaitSemaphores = &batch->semaphore;
+		acquire_info.pWaitDstStageMask = &batch->acquire_stages;
+		acquire_info.commandBufferCount = 1;
+		acquire_info.pCommandBuffers = &batch->acquire_cmd_buf;
+		acquire_info.signalSemaphoreCount = 0;
+		acquire_info.pSignalSemaphores = NULL;
+
+		res = m_vk->vkQueueSubmit(m_graphics_queue, 1, &acquire_info, batch->fence);
+		if(res < 0)
+			ErrorMessage("Error: Failed to submit ownership acquire.", res);
+	}
+
+	batch->serial = m_next_serial++;
+	m_in_flight.push_back(batch);
+
+	return batch->serial;
+}
+
+bool VulkanTransfer::isComplete(uint64_t serial)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for(auto batch : m_in_flight)
+	{
+		if(batch->serial == serial)
+			return m_vk->vkGetFenceStatus(m_device, batch->fence) == VK_SUCCESS;
+	}
+
+	/*batches are only recycled once complete*/
+	return true;
+}
+
+void VulkanTransfer::wait(uint64_t serial)
+{
+	TransferBatch* waited = NULL;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for(auto batch : m_in_flight)
+		{
+			if(batch->serial == serial)
+			{
+				waited = batch;
+				waited->waiters++;
+				break;
+			}
+		}
+	}
+
+	/*batches are only recycled once complete*/
+	if(!waited)
+		return;
+
+	/*without the lock, other threads keep beginning and submitting batches meanwhile.
+	collect() leaves the batch, and its fence, alone while it is waited for.*/
+	m_vk->vkWaitForFences(m_device, 1, &waited->fence, VK_TRUE, UINT64_MAX);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	waited->waiters--;
+}
+
+void VulkanTransfer::collect()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for(size_t i = 0; i < m_in_flight.size();)
+	{
+		TransferBatch* batch = m_in_flight[i];
+
+		if(batch->waiters == 0 && m_vk->vkGetFenceStatus(m_device, batch->fence) == VK_SUCCESS)
+		{
+			recycle(batch);
+			m_free.push_back(batch);
+			m_in_flight[i] = m_in_flight.back();
+			m_in_flight.pop_back();
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+void VulkanTransfer::recycle(TransferBatch* batch)
+{
+	m_vk->vkResetCommandPool(m_device, batch->pool, 0);
+	m_vk->vkResetCommandPool(m_device, batch->acquire_pool, 0);
+	m_vk->vkResetFences(m_device, 1, &batch->fence);
+
+	for(auto buffer : batch->staging_buffers)
+	{
+		vkDestroyBuffer(m_device, buffer, VK_NULL_HANDLE);
+	}
+
+	for(auto& memory : batch->staging_memory)
+	{
+		m_allocator->free(memory);
+	}
+
+	batch->staging_buffers.clear();
+	batch->staging_memory.clear();
+	batch->image_acquires.clear();
+	batch->buffer_acquires.clear();
+	batch->acquire_stages = 0;
+	batch->serial = 0;
+}
+
+bool VulkanTransfer::isDedicated() const noexcept
+{
+	return m_family != m_graphics_family;
+}
+
+uint32_t VulkanTransfer::getFamilyIndex() const noexcept
+{
+	return m_family;
+}
+
+VkQueue VulkanTransfer::getQueue() const noexcept
+{
+	return m_queue;
+}
@@ -0,0 +1,97 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <vulkan.h>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+#include "allocator.h"
+
+/*Work recorded for the transfer queue and submitted as a unit, together with
+everything that has to live until the transfer queue is done with it*/
+struct TransferBatch
+{
+	/*pools of its own, batches are recorded from several threads at once*/
+	VkCommandPool pool = VK_NULL_HANDLE;
+	VkCommandPool acquire_pool = VK_NULL_HANDLE;
+	VkCommandBuffer cmd_buf = VK_NULL_HANDLE;
+	/*records the acquiring half of ownership transfers on the graphics queue*/
+	VkCommandBuffer acquire_cmd_buf = VK_NULL_HANDLE;
+	VkFence fence = VK_NULL_HANDLE;
+	VkSemaphore semaphore = VK_NULL_HANDLE;
+	uint64_t serial = 0;
+	/*threads waiting for the fence, the batch is not recycled until they are done*/
+	uint32_t waiters = 0;
+
+	std::vector<VkImageMemoryBarrier> image_acquires;
+	std::vector<VkBufferMemoryBarrier> buffer_acquires;
+	VkPipelineStageFlags acquire_stages = 0;
+
+	std::vector<VkBuffer> staging_buffers;
+	std::vector<Allocation> staging_memory;
+};
+
+/*Submission helper for the transfer queue. Uploads and readbacks run asynchronously to the
+graphics queue, completion is tracked by the serial submit() returns. Without a dedicated transfer
+queue family the general queue is used and ownership transfers turn into plain barriers.*/
+class VulkanTransfer
+{
+public:
+	VulkanTransfer() = default;
+	~VulkanTransfer() = default;
+
+	bool init(VkDevice device, DeviceDispatch* vk, VulkanAllocator* allocator, VkQueue transfer_queue, uint32_t transfer_family, VkQueue graphics_queue, uint32_t graphics_family);
+	void destroy();
+
+	/*Starts a batch, commands are recorded into batch->cmd_buf until it is submitted*/
+	TransferBatch* begin();
+	/*Host visible buffer, destroyed once the batch completed*/
+	VkBuffer createStagingBuffer(TransferBatch* batch, VkDeviceSize size, void** mapped);
+
+	/*Hands an image written by the batch over to the graphics queue, the acquire is submitted
+	to the graphics queue right after the batch, so later graphics work sees new_layout*/
+	void releaseToGraphics(TransferBatch* batch, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout,
+		VkAccessFlags src_access, VkAccessFlags dst_access, VkPipelineStageFlags dst_stage);
+	/*Same for a whole buffer written by the batch*/
+	void releaseToGraphics(TransferBatch* batch, VkBuffer buffer, VkAccessFlags src_access, VkAccessFlags dst_access, VkPipelineStageFlags dst_stage);
+
+	/*Hands an image over from the graphics queue, the release is recorded on a graphics command buffer
+	which has to signal a semaphore the batch waits on, the batch then records the acquire*/
+	void releaseFromGraphics(VkCommandBuffer graphics_cmd_buf, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout,
+		VkAccessFlags src_access, VkPipelineStageFlags src_stage);
+	void acquireFromGraphics(TransferBatch* batch, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout, VkAccessFlags dst_access);
+
+	/*Submits the batch after wait (if any) was signalled, returns the batch serial*/
+	uint64_t submit(TransferBatch* batch, VkSemaphore wait = VK_NULL_HANDLE, VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+	bool isComplete(uint64_t serial);
+	void wait(uint64_t serial);
+	/*Recycles completed batches and frees their staging buffers*/
+	void collect();
+
+	bool isDedicated() const noexcept;
+	uint32_t getFamilyIndex() const noexcept;
+	VkQueue getQueue() const noexcept;
+
+private:
+	void recycle(TransferBatch* batch);
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	DeviceDispatch* m_vk = NULL;
+	VulkanAllocator* m_allocator = NULL;
+
+	VkQueue m_queue = VK_NULL_HANDLE;
+	uint32_t m_family = 0;
+	VkQueue m_graphics_queue = VK_NULL_HANDLE;
+	uint32_t m_graphics_family = 0;
+
+	std::vector<TransferBatch*> m_free;
+	std::vector<TransferBatch*> m_in_flight;
+	uint64_t m_next_serial = 1;
+
+	/*readbacks are waited for from the recording thread, startup jobs begin batches concurrently*/
+	std::mutex m_mutex;
+};
+
+#endif //TRANSFER_H